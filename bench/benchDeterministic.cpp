@@ -0,0 +1,76 @@
+/**
+ * @file benchDeterministic.cpp
+ * Overhead of the deterministic mode of optimized_method3, which always uses
+ * DETERMINISTIC_CHUNKS partial sums, against the default mode with one partial sum per thread.
+ *
+ * Must be run from the root of the project, to find src/rho.arma.
+ * Usage : benchDeterministic [rPoints [zPoints]]
+ */
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <armadillo>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../src/NuclearDensityCalculator.h"
+
+#define REPEATS 3 ///< Each measure is the best of this number of runs
+
+/**
+ * @return the best time of REPEATS runs of optimized_method3
+ */
+static double bench_method3(const NuclearDensityCalculator& calculator, const arma::vec& rVals, const arma::vec& zVals, arma::mat& result)
+{
+    double best(-1);
+    for (int repeat = 0; repeat<REPEATS; repeat++) {
+        const auto start(std::chrono::steady_clock::now());
+        result = calculator.optimized_method3(rVals, zVals);
+        const double elapsed(std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count());
+        best = best<0 ? elapsed : std::min(best, elapsed);
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    const int rPoints(argc>1 ? std::stoi(argv[1]) : 64);
+    const int zPoints(argc>2 ? std::stoi(argv[2]) : 128);
+    /* no symmetric values, so that the grid is not folded */
+    const arma::vec rVals(arma::linspace(0, 10, rPoints));
+    const arma::vec zVals(arma::linspace(-20, 20.5, zPoints));
+    NuclearDensityCalculator calculator;
+    int maxThreads(1);
+#ifdef _OPENMP
+    maxThreads = omp_get_max_threads();
+#endif
+
+    arma::mat reference;
+    calculator.set_deterministic(true);
+    bench_method3(calculator, rVals, zVals, reference);
+
+    std::cout << "optimized_method3 on " << rPoints << "x" << zPoints << ", "
+              << DETERMINISTIC_CHUNKS << " deterministic chunks" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(16) << "default (s)" << std::setw(18) << "deterministic (s)"
+              << std::setw(12) << "overhead" << std::setw(12) << "same bits" << std::endl;
+    for (int threads = 1; threads<=maxThreads; threads = (threads<maxThreads && 2*threads>maxThreads) ? maxThreads : 2*threads) {
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#endif
+        arma::mat fast, fixed;
+        calculator.set_deterministic(false);
+        const double time_default(bench_method3(calculator, rVals, zVals, fast));
+        calculator.set_deterministic(true);
+        const double time_deterministic(bench_method3(calculator, rVals, zVals, fixed));
+        std::cout << std::setw(8) << threads << std::setw(16) << time_default << std::setw(18) << time_deterministic
+                  << std::setw(11) << std::fixed << std::setprecision(1) << 100.0*(time_deterministic/time_default-1.0) << "%"
+                  << std::setw(12) << (arma::accu(fixed!=reference)==0 ? "yes" : "no") << std::endl;
+        std::cout.unsetf(std::ios::fixed);
+        std::cout << std::setprecision(6);
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file benchReduction.cpp
+ * Microbenchmark of the sum of many full grid matrices computed in parallel, as in
+ * optimized_method3, with ThreadSafeAccumulator and with TreeReducer.
+ *
+ * Usage : benchReduction [terms [rSize [zSize]]]
+ */
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <armadillo>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../src/ThreadSafeAccumulator.hpp"
+#include "../src/TreeReducer.hpp"
+
+#define REPEATS 5 ///< Each measure is the best of this number of runs
+
+/**
+ * @param start time point
+ * @return the seconds elapsed since start
+ */
+static double seconds_since(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+/**
+ * One term of the sum, an outer product like the ones of optimized_method3
+ * @param i index of the term
+ * @param rVals vector of r values
+ * @param zVals vector of z values
+ * @return the term
+ */
+static arma::mat term(int i, const arma::vec& rVals, const arma::vec& zVals)
+{
+    return arma::cos(rVals*(1.0+i))*arma::sin(zVals*(1.0+i)).t();
+}
+
+/**
+ * @return the best time of REPEATS runs of the sum with ThreadSafeAccumulator
+ */
+static double bench_accumulator(int terms, const arma::vec& rVals, const arma::vec& zVals, arma::mat& result)
+{
+    double best(-1);
+    for (int repeat = 0; repeat<REPEATS; repeat++) {
+        const auto start(std::chrono::steady_clock::now());
+        ThreadSafeAccumulator<arma::mat> builder(arma::zeros(rVals.n_elem, zVals.n_elem), operation_type::Add);
+#pragma omp parallel for default(shared)
+        for (int i = 0; i<terms; i++) {
+            builder.push(term(i, rVals, zVals));
+        }
+        result = builder.GetResult();
+        const double elapsed(seconds_since(start));
+        best = best<0 ? elapsed : std::min(best, elapsed);
+    }
+    return best;
+}
+
+/**
+ * @return the best time of REPEATS runs of the sum with TreeReducer
+ */
+static double bench_tree(int terms, const arma::vec& rVals, const arma::vec& zVals, arma::mat& result)
+{
+    double best(-1);
+    for (int repeat = 0; repeat<REPEATS; repeat++) {
+        const auto start(std::chrono::steady_clock::now());
+        TreeReducer<arma::mat> builder(arma::zeros(rVals.n_elem, zVals.n_elem));
+#pragma omp parallel for schedule(static, 1) default(shared)
+        for (int i = 0; i<terms; i++) {
+            builder.local() += term(i, rVals, zVals);
+        }
+        result = builder.GetResult();
+        const double elapsed(seconds_since(start));
+        best = best<0 ? elapsed : std::min(best, elapsed);
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    const int terms(argc>1 ? std::stoi(argv[1]) : 400);
+    const int rSize(argc>2 ? std::stoi(argv[2]) : 256);
+    const int zSize(argc>3 ? std::stoi(argv[3]) : 512);
+    const arma::vec rVals(arma::linspace(0, 10, rSize));
+    const arma::vec zVals(arma::linspace(-20, 20, zSize));
+    const int maxThreads(TreeReducer<arma::mat>::max_threads());
+
+    std::cout << terms << " terms of " << rSize << "x" << zSize << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(16) << "accumulator (s)"
+              << std::setw(16) << "tree (s)" << std::setw(12) << "speedup" << std::setw(14) << "max |diff|" << std::endl;
+    for (int threads = 1; threads<=maxThreads; threads = (threads<maxThreads && 2*threads>maxThreads) ? maxThreads : 2*threads) {
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#endif
+        arma::mat accumulated, reduced;
+        const double accumulator(bench_accumulator(terms, rVals, zVals, accumulated));
+        const double tree(bench_tree(terms, rVals, zVals, reduced));
+        std::cout << std::setw(8) << threads << std::setw(16) << accumulator << std::setw(16) << tree
+                  << std::setw(12) << accumulator/tree << std::setw(14) << arma::abs(accumulated-reduced).max() << std::endl;
+    }
+    return 0;
+}
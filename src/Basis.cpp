@@ -3,21 +3,23 @@
 #include "constants.h"
 
 Basis::Basis(double BR, double BZ, int N, double Q)
-        : br(BR), bz(BZ), mMax(calcMMax(N, Q)), nMax(calcNMax()), n_zMax(calcN_zMax(N, Q)) {}
+        : br(BR), bz(BZ), r_norm(1.0 / (BR * sqrt(PI))), z_norm(pow(BZ, -0.5) * pow(PI, -0.25)),
+          mMax(calcMMax(N, Q)), nMax(calcNMax()), n_zMax(calcN_zMax(N, Q)) {}
 
-Basis::Basis(double BR, double BZ, int N, double Q, const arma::vec &rVals, const arma::vec &zVals)
+Basis::Basis(double BR, double BZ, int N, double Q, const arma::vec &rVals, const arma::vec &zVals, bool with_envelope)
         : Basis(BR, BZ, N, Q) {
+    envelope = with_envelope;
     rvec_mem = rVals;
     rexp_mem = arma::exp(-arma::square(rVals / br) / 2.0);
     computed_r_vals = std::vector<arma::vec>((mMax + 1) * (nMax.max() + 1));
     computed_r_indices = std::vector<bool>((mMax + 1) * (nMax.max() + 1), false);
-    poly_mem.calcLaguerre(mMax, nMax.max(), arma::square(rVals / br));
+    poly_mem.calcLaguerre(nMax, arma::square(rVals / br), true);
 
     zvec_mem = zVals;
     zexp_mem = arma::exp(-arma::square(zVals / bz) / 2.0);
     computed_z_vals = std::vector<arma::vec>(n_zMax.max());
     computed_z_indices = std::vector<bool>(n_zMax.max(), false);
-    poly_mem.calcHermite(n_zMax.max(), zVals / bz);
+    poly_mem.calcHermite(n_zMax.max(), zVals / bz, true);
 
     is_mem = true;
 }
@@ -28,38 +30,63 @@ arma::mat Basis::basisFunc(int m, int n, int nz, const arma::vec &rVec, const ar
 }
 
 arma::vec Basis::zPart(const arma::vec &zVec, int nz, bool use_mem) {
-    double const_factor = pow(bz, -0.5) * pow(PI, -0.25);
-
-    for (int i = 1; i <= nz; i++) {
-        const_factor *= pow(2 * i, -0.5);
-    }
-
     if (use_mem) {
-        return const_factor * zexp_mem % poly_mem.hermite(nz);
+        arma::vec out(zvec_mem.n_elem);
+        zPart(nz, out.memptr());
+        return out;
     }
 
     arma::vec squared_arg = arma::square(zVec / bz);
     arma::vec exp = arma::exp(-squared_arg / 2.0);
-    poly.calcHermite(nz + 1, zVec / bz);
-    return const_factor * exp % poly.hermite(nz);
+    poly.calcHermite(nz + 1, zVec / bz, true);
+    return z_norm * exp % poly.hermite(nz);
 }
 
-arma::vec Basis::rPart(const arma::vec &rVec, int m, int n, bool use_mem) {
-    double const_factor = pow(br, -1) * pow(PI, -0.5);
-
-    for (int i = n + 1; i <= m + n; i++) {
-        const_factor *= pow(i, -0.5);
+void Basis::zPart(int nz, double *out) const {
+    poly_mem.hermite(nz, out);
+    for (arma::uword i = 0; i < zvec_mem.n_elem; i++) {
+        out[i] *= envelope ? z_norm * zexp_mem[i] : z_norm;
     }
+}
 
-    arma::vec pow = arma::pow(rVec / br, m);
+arma::vec Basis::rPart(const arma::vec &rVec, int m, int n, bool use_mem) {
     if (use_mem) {
-        return const_factor * rexp_mem % pow % poly_mem.laguerre(m, n);
+        arma::vec out(rvec_mem.n_elem);
+        rPart(m, n, out.memptr());
+        return out;
     }
 
+    arma::vec pow = arma::pow(rVec / br, m);
     arma::vec squared_arg = arma::square(rVec / br);
     arma::vec exp = arma::exp(-squared_arg / 2.0);
-    poly.calcLaguerre(m + 1, n + 1, squared_arg);
-    return const_factor * exp % pow % poly.laguerre(m, n);
+    poly.calcLaguerre(m + 1, n + 1, squared_arg, true);
+    return r_norm * exp % pow % poly.laguerre(m, n);
+}
+
+void Basis::rPart(int m, int n, double *out) const {
+    poly_mem.laguerre(m, n, out);
+    for (arma::uword i = 0; i < rvec_mem.n_elem; i++) {
+        const double factor = r_norm * std::pow(rvec_mem[i] / br, m);
+        out[i] *= envelope ? factor * rexp_mem[i] : factor;
+    }
+}
+
+arma::vec Basis::rSum(const arma::vec &rVec, int m, const arma::vec &coefs) const {
+    arma::vec squared_arg = arma::square(rVec / br);
+    return r_norm * arma::exp(-squared_arg / 2.0) % arma::pow(rVec / br, m)
+           % Poly::laguerreSum(m, coefs, squared_arg, true);
+}
+
+arma::vec Basis::zSum(const arma::vec &zVec, const arma::vec &coefs) const {
+    return z_norm * arma::exp(-arma::square(zVec / bz) / 2.0) % Poly::hermiteSum(coefs, zVec / bz, true);
+}
+
+arma::vec Basis::rEnvelope(const arma::vec &rVec) const {
+    return arma::exp(-arma::square(rVec / br));
+}
+
+arma::vec Basis::zEnvelope(const arma::vec &zVec) const {
+    return arma::exp(-arma::square(zVec / bz));
 }
 
 int Basis::calcMMax(int N, double Q) {
@@ -87,34 +114,34 @@ arma::mat Basis::basisFunc_mem(int m, int n, int nz) {
     return rPart_mem(m, n).as_col() * zPart_mem(nz).as_row();
 }
 
+void Basis::basisFunc_mem(int m, int n, int nz, arma::mat &out) {
+    const arma::vec &r = rPart_mem(m, n);
+    const arma::vec &z = zPart_mem(nz);
+    out.set_size(r.n_elem, z.n_elem);
+    for (arma::uword j = 0; j < z.n_elem; j++) {
+        out.col(j) = r * z[j];
+    }
+}
+
 /**
  * Returns the value if it was alreadu computed else computes it and
  * saves it.
  */
-arma::vec Basis::zPart_mem(int nz) {
-    if (computed_z_indices[nz]) {
-        return computed_z_vals[nz];
-    } else {
-        arma::vec tmp(zPart(zvec_mem, nz, is_mem));
+const arma::vec &Basis::zPart_mem(int nz) {
+    if (!computed_z_indices[nz]) {
+        computed_z_vals[nz] = zPart(zvec_mem, nz, is_mem);
         computed_z_indices[nz] = true;
-        computed_z_vals[nz] = tmp;
-        return tmp;
     }
+    return computed_z_vals[nz];
 }
 
 /**
  * Returns the already computed value else computes it
  */
-arma::vec Basis::rPart_mem(int m, int n) {
-    if (computed_r_indices[n * (mMax + 1) + m]) {
-        return computed_r_vals[n * (mMax + 1) + m];
-    } else {
-        arma::vec tmp(rPart(rvec_mem, m, n, is_mem));
+const arma::vec &Basis::rPart_mem(int m, int n) {
+    if (!computed_r_indices[n * (mMax + 1) + m]) {
+        computed_r_vals[n * (mMax + 1) + m] = rPart(rvec_mem, m, n, is_mem);
         computed_r_indices[n * (mMax + 1) + m] = true;
-        computed_r_vals[n * (mMax + 1) + m] = tmp;
-        return tmp;
     }
+    return computed_r_vals[n * (mMax + 1) + m];
 }
-
-
-
@@ -19,6 +19,8 @@ class Basis {
 private:
     const double br{}; /**< Orthogonal deformation parameter */
     const double bz{}; /**< Z deformation parameter */
+    const double r_norm{}; /**< Normalisation of every rPart, the n and m dependant part is in the normalised Laguerre polynomials */
+    const double z_norm{}; /**< Normalisation of every zPart, the n_z dependant part is in the normalised Hermite polynomials */
 
 public:
 
@@ -46,8 +48,10 @@ public:
      * @param Q Basis truncation parameter
      * @param rVals radius values vector to be used to precompute values and accelerate computations
      * @param zVals z values vector to be used to precompute values and accelerate computations
+     * @param with_envelope if false the memoised parts are returned without their gaussian factor,
+     * which must then be applied by the caller, @see rEnvelope and zEnvelope
      */
-    Basis(double BR, double BZ, int N, double Q, const arma::vec& rVals, const arma::vec& zVals);
+    Basis(double BR, double BZ, int N, double Q, const arma::vec& rVals, const arma::vec& zVals, bool with_envelope = true);
 
     /**
      * Compute the r part of the function
@@ -65,8 +69,17 @@ public:
      * Function used to access memoised values.
      * @param m quantum number
      * @param n quantum number
+     * @return a reference to the memoised values, valid as long as the basis
      */
-    arma::vec rPart_mem(int m, int n);
+    const arma::vec& rPart_mem(int m, int n);
+
+    /**
+     * Allocation free r part, computed on the rVals given to the memoised constructor
+     * @param m quantum number
+     * @param n quantum number
+     * @param out buffer with room for rVals.n_elem values
+     */
+    void rPart(int m, int n, double* out) const;
 
     /**
      * Compute the z part of the function
@@ -82,8 +95,34 @@ public:
     /**
      * Function used to access memoised values.
      * @param nz quantum number
+     * @return a reference to the memoised values, valid as long as the basis
+     */
+    const arma::vec& zPart_mem(int nz);
+
+    /**
+     * Allocation free z part, computed on the zVals given to the memoised constructor
+     * @param nz quantum number
+     * @param out buffer with room for zVals.n_elem values
+     */
+    void zPart(int nz, double* out) const;
+
+    /**
+     * Weighted sum of r parts with the same m, evaluated with the Clenshaw recurrence
+     * without computing each rPart
+     * @param rVec vector of r values
+     * @param m quantum number
+     * @param coefs coefficient of rPart(m, n) for each n, from n = 0
+     * @return \f$ \sum_n c_n R_{m,n}(r) \f$
+     */
+    arma::vec rSum(const arma::vec& rVec, int m, const arma::vec& coefs) const;
+
+    /**
+     * Weighted sum of z parts, evaluated with the Clenshaw recurrence without computing each zPart
+     * @param zVec vector of z values
+     * @param coefs coefficient of zPart(nz) for each nz, from nz = 0
+     * @return \f$ \sum_{n_z} c_{n_z} Z_{n_z}(z) \f$
      */
-    arma::vec zPart_mem(int nz);
+    arma::vec zSum(const arma::vec& zVec, const arma::vec& coefs) const;
 
     /**
      * Computes
@@ -105,10 +144,35 @@ public:
      */
     arma::mat basisFunc_mem(int m, int n, int nz);
 
+    /**
+     * @see basisFunc_mem but writes into a caller matrix, which is only reallocated if it
+     * does not have the rVals.n_elem x zVals.n_elem size
+     * @param m quantum number
+     * @param n quantum number
+     * @param nz quantum number
+     * @param out receives \f$ \Psi_{m, n, n_z} (r_i, z_j) \f$
+     */
+    void basisFunc_mem(int m, int n, int nz, arma::mat& out);
+
+    /**
+     * Product of the gaussian factors of two r parts
+     * @param rVec vector of r values
+     * @return \f$ e^{-r^2 / b_r^2} \f$
+     */
+    arma::vec rEnvelope(const arma::vec& rVec) const;
+
+    /**
+     * Product of the gaussian factors of two z parts
+     * @param zVec vector of z values
+     * @return \f$ e^{-z^2 / b_z^2} \f$
+     */
+    arma::vec zEnvelope(const arma::vec& zVec) const;
+
 private:
     Poly poly; /**< Polynomial class evaluator */
 
     bool is_mem = false; /**< Is set to true if the rVec and zVec were given at construction -> memoisation  */
+    bool envelope = true; /**< Is set to false if the memoised parts are computed without their gaussian factor */
     arma::vec rvec_mem;/**< rVec given in the constructor */
     arma::vec zvec_mem;/**< zVec given in the constructor */
     arma::vec zexp_mem{};/**< pre-computed vector if is_mem */
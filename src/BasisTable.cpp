@@ -0,0 +1,43 @@
+#include "BasisTable.h"
+
+/**
+ * The polynomials are computed once by the memoised basis, then each column is written
+ * in place by the const, allocation free rPart and zPart, so they can be filled concurrently.
+ */
+BasisTable::BasisTable(double BR, double BZ, int N, double Q, const arma::vec& rVals, const arma::vec& zVals, bool with_envelope)
+{
+    const Basis basis(BR, BZ, N, Q, rVals, zVals, with_envelope);
+
+    r_offsets = column_offsets(basis);
+    arma::ivec m_of(r_offsets(basis.mMax));
+    arma::ivec n_of(r_offsets(basis.mMax));
+    for (int m = 0; m<basis.mMax; m++) {
+        for (int n = 0; n<basis.nMax(m); n++) {
+            m_of(r_offsets(m)+n) = m;
+            n_of(r_offsets(m)+n) = n;
+        }
+    }
+
+    r_table = arma::mat(rVals.n_elem, r_offsets(basis.mMax));
+    z_table = arma::mat(zVals.n_elem, basis.n_zMax.max());
+    const int rCols(r_table.n_cols), zCols(z_table.n_cols);
+#pragma omp parallel for schedule(dynamic) default(shared)
+    for (int k = 0; k<rCols+zCols; k++) {
+        if (k<rCols) {
+            basis.rPart(m_of(k), n_of(k), r_table.colptr(k));
+        }
+        else {
+            basis.zPart(k-rCols, z_table.colptr(k-rCols));
+        }
+    }
+}
+
+arma::uvec BasisTable::column_offsets(const Basis& basis)
+{
+    arma::uvec offsets(basis.mMax+1);
+    offsets(0) = 0;
+    for (int m = 0; m<basis.mMax; m++) {
+        offsets(m+1) = offsets(m)+basis.nMax(m);
+    }
+    return offsets;
+}
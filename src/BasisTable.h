@@ -0,0 +1,80 @@
+/**
+ * @file BasisTable.h
+ */
+
+#ifndef PROJET_IPS1_BASISTABLE_H
+#define PROJET_IPS1_BASISTABLE_H
+
+#include <armadillo>
+
+#include "Basis.h"
+
+/**
+ * @class BasisTable
+ * Read only table of all the r parts and z parts of a basis on a grid.
+ *
+ * Every rPart(m, n) is a column of one contiguous matrix, ordered by m then n, and every
+ * zPart(n_z) is a column of another one. The table is filled once, in parallel, at construction
+ * and never modified afterwards, so it can be shared by all the threads of a parallel region
+ * without copies or memoisation checks.
+ */
+class BasisTable {
+public:
+    /**
+     * Computes all the r parts and z parts of the basis on the grid
+     * @param BR Basis deformation along radius
+     * @param BZ Basis deformation along z axis
+     * @param N Basis truncation parameter
+     * @param Q Basis truncation parameter
+     * @param rVals vector of r values
+     * @param zVals vector of z values
+     * @param with_envelope if false the parts are stored without their gaussian factor
+     */
+    BasisTable(double BR, double BZ, int N, double Q, const arma::vec& rVals, const arma::vec& zVals, bool with_envelope = true);
+
+    /**
+     * @param basis basis of the table
+     * @return the column of rPart(m, 0) in the r table of the basis, with one extra element for the end
+     */
+    static arma::uvec column_offsets(const Basis& basis);
+
+    /**
+     * @param m quantum number
+     * @param n quantum number
+     * @return the column of rPart(m, n) in the r table
+     */
+    inline arma::uword r_column(int m, int n) const { return r_offsets.at(m)+n; }
+
+    /**
+     * @return rPart(m, n) on the r values of the table
+     */
+    inline const arma::subview_col<double> rPart(int m, int n) const { return r_table.col(r_column(m, n)); }
+
+    /**
+     * @return zPart(n_z) on the z values of the table
+     */
+    inline const arma::subview_col<double> zPart(int n_z) const { return z_table.col(n_z); }
+
+    /**
+     * @param m quantum number
+     * @return the r parts rPart(m, 0) ... rPart(m, nMax(m) - 1) as consecutive columns
+     */
+    inline const arma::subview<double> r_block(int m) const { return r_table.cols(r_offsets.at(m), r_offsets.at(m+1)-1); }
+
+    /**
+     * @return all the r parts, one per column
+     */
+    inline const arma::mat& r_parts() const { return r_table; }
+
+    /**
+     * @return all the z parts, zPart(n_z) is the column n_z
+     */
+    inline const arma::mat& z_parts() const { return z_table; }
+
+private:
+    arma::uvec r_offsets; /**< column of rPart(m, 0), with one extra element for the end of the table */
+    arma::mat r_table; /**< rPart(m, n) for all (m, n) of the basis, one per column */
+    arma::mat z_table; /**< zPart(n_z) for all n_z of the basis, one per column */
+};
+
+#endif //PROJET_IPS1_BASISTABLE_H
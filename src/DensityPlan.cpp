@@ -0,0 +1,54 @@
+#include "DensityPlan.h"
+#include "BasisTable.h"
+#include "FactorisationHelper.hpp"
+
+/**
+ * The groups are found once with the FactorisationHelper, in the same order as the sums of
+ * optimized_method3 used to be done, then written level by level in the flat arrays.
+ */
+DensityPlan::DensityPlan(const Basis& basis, const RhoBlocks& rho)
+{
+    FactorisationHelper<quantum_numbers, int>::input_filter filter(no_filter);
+    if (rho.is_symmetric()) {
+        filter = rho.conserves_parity() ? symmetry_parity_filter : symmetry_filter;
+    }
+    else if (rho.conserves_parity()) {
+        filter = parity_filter;
+    }
+    FactorisationHelper<quantum_numbers, int> nza_factored_sum(select_nza, filter);
+    for (int m_a(0), m_amax(basis.mMax); m_a<m_amax; m_a++) {
+        for (int n_a(0), n_amax(basis.nMax(m_a)); n_a<n_amax; n_a++) {
+            for (int nz_a(0), nz_amax(basis.n_zMax(m_a, n_a)); nz_a<nz_amax; nz_a++) {
+                for (int n_b(0), m_bmax(basis.nMax(m_a)); n_b<m_bmax; n_b++) {
+                    for (int nz_b(0), nz_bmax(basis.n_zMax(m_a, n_b)); nz_b<nz_bmax; nz_b++) {
+                        nza_factored_sum.add({m_a, n_a, nz_a, m_a, n_b, nz_b, 1});
+                    }
+                }
+            }
+        }
+    }
+    nza_factored_sum.finalise();
+
+    const arma::uvec columns(BasisTable::column_offsets(basis));
+    nza_offsets.push_back(0);
+    nzb_offsets.push_back(0);
+    a_offsets.push_back(0);
+    for (const factored<quantum_numbers, int>& nza_term : nza_factored_sum) {
+        nza.push_back(nza_term.factor);
+        FactorisationHelper<quantum_numbers, int> nzb_factored(nza_term.factored_out, select_nzb);
+        for (const factored<quantum_numbers, int>& nzb_term : nzb_factored) {
+            nzb.push_back(nzb_term.factor);
+            FactorisationHelper<quantum_numbers, m_n_pair> mana_factored(nzb_term.factored_out, select_mana);
+            for (const factored<quantum_numbers, m_n_pair>& mana_term : mana_factored) {
+                a_columns.push_back(columns(mana_term.factor.m_a)+mana_term.factor.n_a);
+                for (const quantum_numbers e : mana_term.factored_out) {
+                    b_columns.push_back(columns(e.m_b)+e.n_b);
+                    coefficients.push_back(rho(e.m_a, e.n_a, e.nz_a, e.n_b, e.nz_b)*e.count);
+                }
+                a_offsets.push_back(coefficients.size());
+            }
+            nzb_offsets.push_back(a_columns.size());
+        }
+        nza_offsets.push_back(nzb.size());
+    }
+}
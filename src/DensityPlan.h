@@ -0,0 +1,111 @@
+/**
+ * @file DensityPlan.h
+ */
+
+#ifndef PROJET_IPS1_DENSITYPLAN_H
+#define PROJET_IPS1_DENSITYPLAN_H
+
+#include <armadillo>
+#include <vector>
+
+#include "Basis.h"
+#include "RhoBlocks.h"
+
+/**
+ * @class DensityPlan
+ * Compiled form of the factorised sum of optimized_method3.
+ *
+ * The density is summed as nested groups: for each n_za, for each n_zb, for each (m_a, n_a),
+ * the terms (m_b, n_b) with their coefficient. The plan holds the four levels in flat arrays,
+ * each group knowing the range of its children in the next level (offsets, CSR like).
+ * The r parts are given by their column in a BasisTable and the coefficients are
+ * rho times the number of times the term is counted, so evaluating the plan on a grid
+ * only reads the table and these arrays.
+ *
+ * The plan only depends on the basis and on rho, so it is compiled once and reused for every grid.
+ */
+class DensityPlan {
+public:
+    DensityPlan() = default;
+
+    /**
+     * Compiles the plan. If rho is symmetric only the terms a <= b are kept and the other ones
+     * are counted twice, if it conserves parity the terms of odd n_za + n_zb are dropped.
+     * @param basis basis in which rho is written
+     * @param rho blocks of the density matrix
+     */
+    DensityPlan(const Basis& basis, const RhoBlocks& rho);
+
+    /**
+     * @return the number of n_za groups
+     */
+    inline int size() const { return static_cast<int>(nza.size()); }
+
+    /**
+     * @param g n_za group
+     * @return the quantum number n_za of the group
+     */
+    inline int nz_a(int g) const { return nza[g]; }
+
+    /**
+     * @return the first n_zb group of the n_za group g, the last one is nzb_end(g) - 1
+     */
+    inline arma::uword nzb_begin(int g) const { return nza_offsets[g]; }
+
+    inline arma::uword nzb_end(int g) const { return nza_offsets[g+1]; }
+
+    /**
+     * @param k n_zb group
+     * @return the quantum number n_zb of the group
+     */
+    inline int nz_b(arma::uword k) const { return nzb[k]; }
+
+    /**
+     * @return the first (m_a, n_a) group of the n_zb group k, the last one is a_end(k) - 1
+     */
+    inline arma::uword a_begin(arma::uword k) const { return nzb_offsets[k]; }
+
+    inline arma::uword a_end(arma::uword k) const { return nzb_offsets[k+1]; }
+
+    /**
+     * @param j (m_a, n_a) group
+     * @return the column of rPart(m_a, n_a) in a BasisTable
+     */
+    inline arma::uword a_column(arma::uword j) const { return a_columns[j]; }
+
+    /**
+     * @return the first term of the (m_a, n_a) group j, the last one is b_end(j) - 1
+     */
+    inline arma::uword b_begin(arma::uword j) const { return a_offsets[j]; }
+
+    inline arma::uword b_end(arma::uword j) const { return a_offsets[j+1]; }
+
+    /**
+     * @param t term
+     * @return the column of rPart(m_b, n_b) in a BasisTable
+     */
+    inline arma::uword b_column(arma::uword t) const { return b_columns[t]; }
+
+    /**
+     * @param t term
+     * @return rho(a, b) times the count of the term
+     */
+    inline double coefficient(arma::uword t) const { return coefficients[t]; }
+
+    /**
+     * @return the number of terms
+     */
+    inline arma::uword terms() const { return coefficients.size(); }
+
+private:
+    std::vector<int> nza; /**< n_za of each n_za group */
+    std::vector<arma::uword> nza_offsets; /**< first n_zb group of each n_za group, plus the end */
+    std::vector<int> nzb; /**< n_zb of each n_zb group */
+    std::vector<arma::uword> nzb_offsets; /**< first (m_a, n_a) group of each n_zb group, plus the end */
+    std::vector<arma::uword> a_columns; /**< table column of rPart(m_a, n_a) of each (m_a, n_a) group */
+    std::vector<arma::uword> a_offsets; /**< first term of each (m_a, n_a) group, plus the end */
+    std::vector<arma::uword> b_columns; /**< table column of rPart(m_b, n_b) of each term */
+    std::vector<double> coefficients; /**< rho times count of each term */
+};
+
+#endif //PROJET_IPS1_DENSITYPLAN_H
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Df3Writer.h"
+#include "constants.h"
+
+namespace {
+/**
+ * Quantises values to big endian unsigned integers of Bytes bytes,
+ * the loop over the bytes of a voxel is unrolled at compile time so the loop over the voxels vectorises
+ * @param values values to quantise
+ * @param size number of values
+ * @param scale factor from a value to a voxel
+ * @param top largest voxel
+ * @param voxels output, size * Bytes bytes
+ */
+template<unsigned Bytes>
+void quantise(const double* values, const arma::uword size, const double scale, const double top, unsigned char* voxels)
+{
+#pragma omp parallel for simd default(shared) if(size>=DF3_PARALLEL_VOXELS)
+    for (arma::uword i = 0; i<size; i++) {
+        const uint32_t voxel(static_cast<uint32_t>(std::min(top, std::fabs(values[i])*scale)));
+        for (unsigned b = 0; b<Bytes; b++) {
+            voxels[i*Bytes+b] = static_cast<unsigned char>(voxel >> (8*(Bytes-1-b)));
+        }
+    }
+}
+}
+
+Df3Writer::Df3Writer(const std::string& name, arma::uword xSize, arma::uword ySize, arma::uword zSize, double max,
+        int bits)
+        :filename(name), nx(xSize), ny(ySize), nz(zSize), bytes(bits/8),
+         top(std::ldexp(1.0, bits)-1), scale(max>0 ? top/max : 0.0)
+{
+    if (bits!=8 && bits!=16 && bits!=32) {
+        throw std::invalid_argument("a df3 voxel has 8, 16 or 32 bits, not "+std::to_string(bits));
+    }
+    if (nx>0xffffu || ny>0xffffu || nz>0xffffu) {
+        throw std::invalid_argument("a df3 volume has at most 65535 points along each axis");
+    }
+    fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd<0) {
+        throw std::runtime_error("cannot create "+filename);
+    }
+    /* dimensions as big endian 16 bits integers */
+    const unsigned char header[6] = {
+            static_cast<unsigned char>(nx >> 8u), static_cast<unsigned char>(nx & 0xffu),
+            static_cast<unsigned char>(ny >> 8u), static_cast<unsigned char>(ny & 0xffu),
+            static_cast<unsigned char>(nz >> 8u), static_cast<unsigned char>(nz & 0xffu)};
+    /* the destructor is not run when the constructor throws */
+    try {
+        write_at(header, sizeof(header), 0);
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+}
+
+Df3Writer::~Df3Writer()
+{
+    if (fd>=0) {
+        close(fd);
+    }
+}
+
+void Df3Writer::write_slice(arma::uword z, const double* values) const
+{
+    if (z>=nz) {
+        throw std::invalid_argument("the slice "+std::to_string(z)+" is out of the volume");
+    }
+    /* one buffer per thread, kept from a slice to the next */
+    static thread_local std::vector<unsigned char> voxels;
+    voxels.resize(nx*ny*bytes);
+    switch (bytes) {
+    case 1:
+        quantise<1>(values, nx*ny, scale, top, voxels.data());
+        break;
+    case 2:
+        quantise<2>(values, nx*ny, scale, top, voxels.data());
+        break;
+    default:
+        quantise<4>(values, nx*ny, scale, top, voxels.data());
+    }
+    write_at(voxels.data(), voxels.size(), 6+z*nx*ny*bytes);
+}
+
+void Df3Writer::write_slice(arma::uword z, const arma::mat& slice) const
+{
+    if (slice.n_rows!=nx || slice.n_cols!=ny) {
+        throw std::invalid_argument("the slice is "+std::to_string(slice.n_rows)+" x "+std::to_string(slice.n_cols)
+                                    +", the volume "+std::to_string(nx)+" x "+std::to_string(ny));
+    }
+    write_slice(z, slice.memptr());
+}
+
+void Df3Writer::write_at(const unsigned char* data, size_t size, size_t offset) const
+{
+    while (size>0) {
+        const ssize_t written(pwrite(fd, data, size, offset));
+        if (written<0 && errno==EINTR) {
+            continue;
+        }
+        if (written<=0) {
+            throw std::runtime_error("cannot write "+filename);
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+}
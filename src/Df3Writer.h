@@ -0,0 +1,81 @@
+/**
+ * @file Df3Writer.h
+ */
+
+#ifndef PROJET_IPS1_DF3WRITER_H
+#define PROJET_IPS1_DF3WRITER_H
+
+#include <armadillo>
+#include <string>
+
+/**
+ * @class Df3Writer
+ * Writes a POV-Ray density file (df3) one z slice at a time.
+ *
+ * The normalisation maximum is given up front, so a slice is quantised and written as soon as
+ * it is produced and the volume never has to be held in memory. Each slice goes at its own
+ * place in the file with a single pwrite, so slices can be written in any order and
+ * by several threads at once.
+ * The voxels are unsigned big endian integers of 8, 16 or 32 bits, as read by POV-Ray.
+ */
+class Df3Writer {
+public:
+    /**
+     * Creates the file and writes the header
+     * @param name the name of the df3 file (must end with .df3)
+     * @param xSize number of points along x
+     * @param ySize number of points along y
+     * @param zSize number of slices
+     * @param max value written as the largest voxel, the voxels are |v| / max
+     * @param bits size of a voxel, 8, 16 or 32
+     * @throw std::invalid_argument if a dimension does not fit in the 16 bits of the header
+     * or if bits is not 8, 16 or 32
+     * @throw std::runtime_error if the file can not be created or its header written
+     */
+    Df3Writer(const std::string& name, arma::uword xSize, arma::uword ySize, arma::uword zSize, double max, int bits = 8);
+
+    Df3Writer(const Df3Writer&) = delete;
+
+    Df3Writer& operator=(const Df3Writer&) = delete;
+
+    /**
+     * Closes the file
+     */
+    ~Df3Writer();
+
+    /**
+     * Quantises and writes a slice, the voxels go through a buffer kept by the calling thread
+     * @param z index of the slice
+     * @param values nx * ny values, x varying fastest
+     * @throw std::invalid_argument if z is not a slice of the volume
+     * @throw std::runtime_error if the slice can not be written
+     */
+    void write_slice(arma::uword z, const double* values) const;
+
+    /**
+     * @see write_slice
+     * @param z index of the slice
+     * @param slice nx x ny matrix
+     * @throw std::invalid_argument if the slice is not nx x ny
+     */
+    void write_slice(arma::uword z, const arma::mat& slice) const;
+
+private:
+    const std::string filename; /**< name of the file, for the error messages */
+    const arma::uword nx, ny, nz; /**< dimensions of the volume */
+    const arma::uword bytes; /**< size of a voxel in bytes */
+    const double top; /**< largest voxel, 2^bits - 1 */
+    const double scale; /**< factor from a value to a voxel */
+    int fd = -1; /**< descriptor of the open file */
+
+    /**
+     * Writes all the bytes at a position of the file
+     * @param data bytes to write
+     * @param size number of bytes
+     * @param offset position in the file
+     * @throw std::runtime_error if the bytes can not be written
+     */
+    void write_at(const unsigned char* data, size_t size, size_t offset) const;
+};
+
+#endif //PROJET_IPS1_DF3WRITER_H
@@ -12,8 +12,26 @@
 
 
 #include <vector>
-#include <deque>
-#include <algorithm>
+#include <unordered_map>
+#include <functional>
+
+/**
+ * Contiguous read only range of entries, in the flat storage of a FactorisationHelper
+ * @tparam T the type of the entries
+ */
+template<typename T>
+struct entry_range {
+  const T* first;
+  const T* last;
+
+  inline const T* begin() const { return first; }
+
+  inline const T* end() const { return last; }
+
+  inline size_t size() const { return last-first; }
+
+  inline const T& operator[](size_t index) const { return first[index]; }
+};
 
 /**
  * Struct to hold the values of a factorisation
@@ -23,17 +41,16 @@
 template<typename T, typename fa>
 struct factored {
   fa factor;
-  std::vector<T> factored_out;
-  inline factored(fa fact, std::vector<T>&& vec)
-          :factor(fact), factored_out(std::move(vec))
-  {
-      factored_out.reserve(50);
-  }
+  entry_range<T> factored_out; /**< the entries of this factor, they belong to the helper */
 };
 
 /**
  * @class FactorisationHelper
- * @tparam fa the type of what we factor out (can be a pair of values, of whatever)
+ * The entries are grouped by the value of the selector with a hash map, in the order in which
+ * each value first appears. Once finalised, the groups are stored in CSR form: all the entries
+ * in one flat vector, ordered by group, and for each group its factor and its range.
+ * @tparam fa the type of what we factor out (can be a pair of values, of whatever), it needs
+ * std::hash and operator==
  * @tparam T the type of the entries we added
  */
 template<typename T, typename f>
@@ -43,95 +60,129 @@ public:
     typedef f (* selector_function)(const T& a); /**< A function  */
 
     /**
-     * Constructor of the factorisation helper.
+     * Constructor of the factorisation helper, entries are then given with add and the groups
+     * are available after finalise
      * @param filter to filter some values out
      * @param selector to select the values we want to factor out;
      */
-    explicit FactorisationHelper(selector_function selector, input_filter filter = [](T& a) { return true; });
+    explicit FactorisationHelper(selector_function selector, input_filter filter = [](T& a __attribute__((unused))) { return true; });
 
     /**
-     * Constructor that imports a list of entries
-     * @param input vector of type T entries
+     * Constructor that imports a range of entries and finalises the groups
+     * @param input range of type T entries, they are copied
      * @param filter to filter some values out
      * @param selector to select the values we want to factor out;
      */
-    FactorisationHelper(std::vector<T>& input, selector_function selector, input_filter filter = [](T& a __attribute__((unused))) { return true; });
+    FactorisationHelper(const entry_range<T>& input, selector_function selector, input_filter filter = [](T& a __attribute__((unused))) { return true; });
+
+    /**
+     * The groups point to the storage of the helper, so it can be moved but not copied
+     */
+    FactorisationHelper(const FactorisationHelper&) = delete;
+
+    FactorisationHelper& operator=(const FactorisationHelper&) = delete;
+
+    FactorisationHelper(FactorisationHelper&&) = default;
 
     /**
-     * Adds an entry to the factoriser
+     * Adds an entry to the factoriser, only before finalise
      * @param entry
      */
     inline void add(T&& entry);
-    // inline void add(T entry);
 
     /**
-     * Called at the end to get the factorisation result
-     * @return a list of structs. Each struct contains a "factor" which is the key that was factored out
-     * of the values that are in the list "factored_out"
+     * Builds the CSR storage of the groups from the added entries.
+     * Must be called once, after the last add and before the groups are read.
+     * The groups can then be read by several threads at once.
      */
-    //std::vector<struct factored<T, f>> get_factored();
+    void finalise();
 
-    inline factored<T, f>& operator[](int index) { return out[index]; };
+    inline const factored<T, f>& operator[](int index) const { return groups[index]; };
 
-    inline typename std::deque<struct factored<T, f>>::iterator begin() { return out.begin(); };
+    inline typename std::vector<factored<T, f>>::const_iterator begin() const { return groups.begin(); };
 
-    inline typename std::deque<struct factored<T, f>>::iterator end() { return out.end(); };
+    inline typename std::vector<factored<T, f>>::const_iterator end() const { return groups.end(); };
 
-    inline size_t size() { return out.size(); };
+    inline size_t size() const { return groups.size(); };
 
 private:
     const input_filter filter;
     const selector_function selector;
-    std::deque<struct factored<T, f>> out{};
+    std::unordered_map<f, unsigned> group_index{}; /**< group of each factor, while adding */
+    std::vector<f> factors{}; /**< factor of each group, in order of first appearance */
+    std::vector<unsigned> group_of{}; /**< group of each added entry */
+    std::vector<T> added{}; /**< entries in the order they were added */
+    std::vector<T> entries{}; /**< entries ordered by group, once finalised */
+    std::vector<factored<T, f>> groups{}; /**< one range of entries per group, once finalised */
 
     /**
      * As we add entries, they are placed in the right categories
      * to factor them out given a selector that "selects" a peculiar value in our entry
-     * @tparam fa the type of what we factor out (can be a pair of values, of whatever)
-     * @tparam T the type of the entries we added
      * @param entry
      */
     inline void dispatch_entry(const T& entry);
 };
 
 /**
- * As we add entries, they are placed in the right categories
- * to factor them out given a selector that "selects" a peculiar value in our entry
- * @tparam fa the type of what we factor out (can be a pair of values, of whatever)
- * @tparam T the type of the entries we added
- * @param entry
+ * The group of the entry is found in the hash map, in constant time whatever the number of groups
  */
 template<typename T, typename f>
 inline void FactorisationHelper<T, f>::dispatch_entry(const T& entry)
 {
-    f fac = selector(entry);
-    auto it = std::find_if(out.begin(), out.end(), [&fac](const struct factored<T, f>& x) { return x.factor==fac; });
-    if (it!=out.end()) {
-        it->factored_out.emplace_back(std::move(entry));
-    }
-    else {
-        out.emplace_back(fac, std::vector<T>{std::move(entry)});
+    const auto inserted = group_index.emplace(selector(entry), factors.size());
+    if (inserted.second) {
+        factors.push_back(inserted.first->first);
     }
+    group_of.push_back(inserted.first->second);
+    added.push_back(entry);
 }
 
-
+/**
+ * Counting sort of the entries by group, which keeps the order of the entries inside a group
+ */
 template<typename T, typename f>
-FactorisationHelper<T, f>::FactorisationHelper(selector_function selec, input_filter filt)
-        :filter(filt), selector(selec)
+void FactorisationHelper<T, f>::finalise()
 {
-   // out.reserve(500);
+    std::vector<size_t> offsets(factors.size()+1, 0);
+    for (unsigned g : group_of) {
+        offsets[g+1]++;
+    }
+    for (size_t g = 0; g<factors.size(); g++) {
+        offsets[g+1] += offsets[g];
+    }
+
+    entries.resize(added.size());
+    std::vector<size_t> cursor(offsets.begin(), offsets.end()-1);
+    for (size_t k = 0; k<added.size(); k++) {
+        entries[cursor[group_of[k]]++] = added[k];
+    }
+
+    groups.reserve(factors.size());
+    for (size_t g = 0; g<factors.size(); g++) {
+        groups.push_back({factors[g], {entries.data()+offsets[g], entries.data()+offsets[g+1]}});
+    }
+
+    group_index.clear();
+    std::vector<unsigned>().swap(group_of);
+    std::vector<T>().swap(added);
 }
 
 template<typename T, typename f>
-FactorisationHelper<T, f>::FactorisationHelper(std::vector<T>& input, selector_function select, input_filter filt)
+FactorisationHelper<T, f>::FactorisationHelper(selector_function selec, input_filter filt)
+        :filter(filt), selector(selec) { }
+
+template<typename T, typename f>
+FactorisationHelper<T, f>::FactorisationHelper(const entry_range<T>& input, selector_function select, input_filter filt)
         : FactorisationHelper<T, f>::FactorisationHelper(select, filt)
 {
-//    out.reserve(10+input.size()/5);
-    for (auto& in : input) {
+    added.reserve(input.size());
+    group_of.reserve(input.size());
+    for (T in : input) {
         if (likely(filter(in))) {
-            dispatch_entry(std::move(in));
+            dispatch_entry(in);
         }
     }
+    finalise();
 }
 
 template<typename T, typename f>
@@ -153,13 +204,18 @@ typedef struct m_n_pair {
   int m_a, n_a;
 } m_n_pair;
 
+/**
+ * Keeps only the unordered pairs a <= b, in the flat basis index (m, n, n_z), and counts
+ * the off diagonal ones twice. Only valid if rho is symmetric.
+ * Both states have the same m so the flat order is the lexicographic order on (n, n_z).
+ */
 static inline bool symmetry_filter(quantum_numbers& entry)
 {
-    if (entry.n_b<entry.n_a && entry.nz_b<entry.nz_a) {
+    if (entry.n_a<entry.n_b || (entry.n_a==entry.n_b && entry.nz_a<entry.nz_b)) {
         entry.count *= 2;
         return true;
     }
-    else if (entry.n_b<=entry.n_a || entry.nz_b<=entry.nz_a) {
+    else if (entry.n_a==entry.n_b && entry.nz_a==entry.nz_b) {
         return true;
     }
     else {
@@ -167,6 +223,21 @@ static inline bool symmetry_filter(quantum_numbers& entry)
     }
 }
 
+/**
+ * Keeps every entry, used when rho is not symmetric
+ */
+static inline bool no_filter(quantum_numbers& entry __attribute__((unused))) { return true; }
+
+/**
+ * Drops the pairs of opposite z parity, only valid if rho conserves parity
+ */
+static inline bool parity_filter(quantum_numbers& entry) { return (entry.nz_a+entry.nz_b)%2==0; }
+
+/**
+ * Both symmetry_filter and parity_filter
+ */
+static inline bool symmetry_parity_filter(quantum_numbers& entry) { return parity_filter(entry) && symmetry_filter(entry); }
+
 static inline int select_nza(const quantum_numbers& entry) { return entry.nz_a; }
 // or we could use [](const quantum_numbers & q){return q.nz_a;}
 
@@ -176,4 +247,14 @@ static inline struct m_n_pair select_mana(const quantum_numbers& entry) { return
 
 static inline bool operator==(const struct m_n_pair l, const struct m_n_pair r) { return l.m_a==r.m_a && l.n_a==r.n_a; }
 
+namespace std {
+/**
+ * Hash of a (m, n) pair to group entries on it, both numbers are small
+ */
+template<>
+struct hash<m_n_pair> {
+  inline size_t operator()(const m_n_pair& pair) const { return hash<int>()((pair.m_a << 16) ^ pair.n_a); }
+};
+}
+
 #endif //PROJET_IPS1_FACTORISATIONFINDER_H
\ No newline at end of file
@@ -1,24 +1,35 @@
 #include <vector>
+#include <list>
 #include <memory>
+#include <stdexcept>
+#include <exception>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "NuclearDensityCalculator.h"
+#include "BasisTable.h"
+#include "RhoFile.h"
+#include "Df3Writer.h"
 #include "Chrono.hpp"
-#include "ThreadSafeAccumulator.hpp"
-#include "FactorisationHelper.hpp"
+#include "TreeReducer.hpp"
 
 
 arma::mat NuclearDensityCalculator::naive_method(const arma::vec& rVals, const arma::vec& zVals)
 {
     Chrono local("naive_method");
+    Basis basis_mem(br, bz, N, Q, rVals, zVals);
+    arma::mat funcA(rVals.size(), zVals.size()); /* Written in place by basisFunc_mem, allocated once */
+    arma::mat funcB(rVals.size(), zVals.size());
     arma::mat result = arma::zeros(rVals.size(), zVals.size()); // number of points on r- and z- axes
     for (int m = 0; m<basis.mMax; m++) {
         for (int n = 0; n<basis.nMax(m); n++) {
             for (int n_z = 0; n_z<basis.n_zMax(m, n); n_z++) {
+                basis_mem.basisFunc_mem(m, n, n_z, funcA);
                 for (int mp = 0; mp<basis.mMax; mp++) {
                     for (int np = 0; np<basis.nMax(mp); np++) {
                         for (int n_zp = 0; n_zp<basis.n_zMax(mp, np); n_zp++) {
-                            arma::mat funcA = basis.basisFunc(m, n, n_z, rVals, zVals);
-                            arma::mat funcB = basis.basisFunc(mp, np, n_zp, rVals, zVals);
+                            basis_mem.basisFunc_mem(mp, np, n_zp, funcB);
                             result += funcA%funcB*rho(m, n, n_z, mp, np, n_zp);
                         }
                     }
@@ -33,15 +44,18 @@ arma::mat NuclearDensityCalculator::naive_method(const arma::vec& rVals, const a
 arma::mat NuclearDensityCalculator::optimized_method1(const arma::vec& rVals, const arma::vec& zVals)
 {
     Chrono local("optimized_method1");
+    Basis basis_mem(br, bz, N, Q, rVals, zVals);
+    arma::mat funcA(rVals.size(), zVals.size());
+    arma::mat funcB(rVals.size(), zVals.size());
     arma::mat result = arma::zeros(rVals.size(), zVals.size()); // number of points on r- and z- axes
     for (int m_a = 0; m_a<basis.mMax; m_a++) {
         for (int n_a = 0; n_a<basis.nMax(m_a); n_a++) {
             for (int n_z_a = 0; n_z_a<basis.n_zMax(m_a, n_a); n_z_a++) {
+                basis_mem.basisFunc_mem(m_a, n_a, n_z_a, funcA);
                 for (int n_b = 0; n_b<basis.nMax(m_a); n_b++) {
                     for (int n_z_b = 0; n_z_b<basis.n_zMax(m_a, n_b); n_z_b++) {
-                        arma::mat funcA = basis.basisFunc(m_a, n_a, n_z_a, rVals, zVals);
-                        arma::mat funcB = basis.basisFunc(m_a, n_b, n_z_b, rVals, zVals);
-                        result += funcA%funcB*rho(m_a, n_a, n_z_a, m_a, n_b, n_z_b);
+                        basis_mem.basisFunc_mem(m_a, n_b, n_z_b, funcB);
+                        result += funcA%funcB*rho_blocks(m_a, n_a, n_z_a, n_b, n_z_b);
                     }
                 }
             }
@@ -57,6 +71,9 @@ arma::mat NuclearDensityCalculator::optimized_method2(const arma::vec& rVals, co
     struct opt2_pair {
       int n, nz;
     };
+    Basis basis_mem(br, bz, N, Q, rVals, zVals);
+    arma::mat func(rVals.size(), zVals.size());
+    arma::mat tmp(rVals.size(), zVals.size());
     arma::mat builder = arma::zeros(rVals.size(), zVals.size());
     for (int m_a = 0; m_a<basis.mMax; m_a++) {
         std::list<opt2_pair> list;
@@ -66,11 +83,13 @@ arma::mat NuclearDensityCalculator::optimized_method2(const arma::vec& rVals, co
             }
         }
         for (auto a = list.begin(); a!=list.end(); a++) {
-            arma::mat tmp = arma::zeros(rVals.size(), zVals.size());
+            tmp.zeros();
             for (auto b : list) {
-                tmp += basis.basisFunc(m_a, b.n, b.nz, rVals, zVals)*rho(m_a, a->n, a->nz, m_a, b.n, b.nz);
+                basis_mem.basisFunc_mem(m_a, b.n, b.nz, func);
+                tmp += func*rho_blocks(m_a, a->n, a->nz, b.n, b.nz);
             }
-            builder += basis.basisFunc(m_a, a->n, a->nz, rVals, zVals)%tmp;
+            basis_mem.basisFunc_mem(m_a, a->n, a->nz, func);
+            builder += func%tmp;
         }
     }
     return builder;
@@ -83,81 +102,376 @@ arma::mat NuclearDensityCalculator::optimized_method2(const arma::vec& rVals, co
  */
 arma::mat NuclearDensityCalculator::optimized_method3(const arma::vec& rVals, const arma::vec& zVals) const
 {
+    arma::vec rFolded, zFolded;
+    arma::uvec rIndex, zIndex;
+    if (fold_grid(rVals, zVals, rFolded, zFolded, rIndex, zIndex)) {
+        return optimized_method3(rFolded, zFolded).submat(rIndex, zIndex);
+    }
     Chrono local("optimized_method3");
-    FactorisationHelper<struct quantum_numbers, int> nza_factored_sum(select_nza, symmetry_filter);
-    for (int m_a(0), m_amax(basis.mMax); m_a<m_amax; m_a++) {  /* Rather than making things hard, let's just use the most naive method */
-        for (int n_a(0), n_amax(basis.nMax(m_a)); n_a<n_amax; n_a++) {
-            for (int nz_a(0), nz_amax(basis.n_zMax(m_a, n_a)); nz_a<nz_amax; nz_a++) {
-                for (int n_b(0), m_bmax(basis.nMax(m_a)); n_b<m_bmax; n_b++) {
-                    for (int nz_b(0), nz_bmax(basis.n_zMax(m_a, n_b)); nz_b<nz_bmax; nz_b++) {
-                        nza_factored_sum.add({m_a, n_a, nz_a, m_a, n_b, nz_b, 1});
+    const int zSize(zVals.size()), rSize(rVals.size());
+    /* The terms are split in partial sums merged by a fixed tree: the n_za group i goes to the sum
+     * i % slots, which adds its groups in increasing i, so the result only depends on slots.
+     * A slot without any group would only cost a buffer and a merge. */
+    const int groups(plan.size());
+    const int slots(deterministic ? std::min(DETERMINISTIC_CHUNKS, std::max(groups, 1)) : TreeReducer<arma::mat>::max_threads());
+    TreeReducer<arma::mat> builder(arma::zeros(rSize, zSize), slots);
+    /* Read only, shared by all the threads */
+    const BasisTable table(br, bz, N, Q, rVals, zVals, !hoist_envelope);
+    const arma::mat& rTable(table.r_parts());
+#pragma omp parallel for schedule(dynamic) default(shared)
+    for (int slot = 0; slot<slots; slot++) {
+        arma::mat& sum(builder.local(slot));
+        for (int i = slot; i<groups; i += slots) {
+            /* nza_zpart is the loop constant */
+            const arma::rowvec nza_zpart(table.zPart(plan.nz_a(i)).t());
+            arma::mat tmp(arma::zeros(rSize, zSize));
+            for (arma::uword k = plan.nzb_begin(i); k<plan.nzb_end(i); k++) {
+                /* nzb_zpart is the loop constant */
+                const arma::rowvec nzb_zpart(table.zPart(plan.nz_b(k)).t());
+                arma::colvec all_rpart(arma::zeros(rSize));
+                for (arma::uword j = plan.a_begin(k); j<plan.a_end(k); j++) {
+                    arma::colvec mbnb_rpart(arma::zeros(rSize));
+                    for (arma::uword t = plan.b_begin(j); t<plan.b_end(j); t++) {
+                        mbnb_rpart += rTable.col(plan.b_column(t))*plan.coefficient(t);
                     }
+                    all_rpart += mbnb_rpart%rTable.col(plan.a_column(j));
                 }
+                tmp += all_rpart*nzb_zpart;
             }
+            sum += tmp.each_row()%nza_zpart;
         }
     }
+    arma::mat result(builder.GetResult());
+    if (hoist_envelope) {
+        result %= basis.rEnvelope(rVals)*basis.zEnvelope(zVals).t();
+    }
+    return result;
+}
 
-    const int zSize(zVals.size()), rSize(rVals.size());
-    std::shared_ptr<ThreadSafeAccumulator<arma::mat>> builder(std::make_shared<ThreadSafeAccumulator<arma::mat >>(arma::zeros(rSize, zSize), operation_type::Add));
-    const arma::colvec unit(rSize, arma::fill::ones);
-    const Basis basis_mem(br, bz, N, Q, rVals, zVals);
-    /* nza_zpart is the loop constant */
-#pragma omp parallel for default(shared)
-    for (size_t i = 0; i<nza_factored_sum.size(); i++) {
-        Basis basis_local(basis_mem); /* We copy the basis in each thread, strangely the private openMP dont work */
-        const arma::rowvec nza_zpart(basis_local.zPart_mem(nza_factored_sum[i].factor).as_row());
-        arma::mat tmp(arma::zeros(rSize, zSize));
-        /* We factor out nzb of the sum left to compute */
-        FactorisationHelper<quantum_numbers, int> nzb_factored(nza_factored_sum[i].factored_out, select_nzb);
-        /* nzb_zpart is the loop constant */
-        for (factored<quantum_numbers, int>& nzb_term : nzb_factored) {
-            const arma::rowvec nzb_zpart(basis_local.zPart_mem(nzb_term.factor).as_row());
-            arma::colvec all_rpart(arma::zeros(rSize));
-            /* We factor out the pair ma na of the sum that is left to compute */
-            FactorisationHelper<quantum_numbers, m_n_pair> mana_factored(nzb_term.factored_out, select_mana);
-            for (const factored<quantum_numbers, m_n_pair>& mana_term : mana_factored) {
-                /* mana_rpart is the loop constant */
-                const arma::colvec mana_rpart(basis_local.rPart_mem(mana_term.factor.m_a, mana_term.factor.n_a));
-                arma::colvec mbnb_rpart(arma::zeros(rSize));
-                /* We could factor out the pair mb and nb but its useless */
-                for (const quantum_numbers e : mana_term.factored_out) {
-                    mbnb_rpart += basis_local.rPart_mem(e.m_b, e.n_b)*(rho(e.m_a, e.n_a, e.nz_a, e.m_b, e.n_b, e.nz_b)*e.count);
+/**
+ * The density can be written as
+ * \f$ \sum_{m, n_a, n_b} R_{m n_a}(r) R_{m n_b}(r) \, T_{m n_a n_b}(z) \f$ with
+ * \f$ T_{m n_a n_b} = \sum_{n_{za}, n_{zb}} \rho \, Z_{n_{za}} Z_{n_{zb}} \f$.
+ * Each (m, n_a, n_b) triple is one column of rPairs and of zPairs, the T columns are
+ * obtained with one GEMM per (m, n_a) and the result is the product rPairs * zPairs^T.
+ * If rho is symmetric T_{m n_a n_b} == T_{m n_b n_a}, so only n_a <= n_b is computed
+ * and the off diagonal pairs are counted twice.
+ */
+arma::mat NuclearDensityCalculator::gemm_method(const arma::vec& rVals, const arma::vec& zVals) const
+{
+    arma::vec rFolded, zFolded;
+    arma::uvec rIndex, zIndex;
+    if (fold_grid(rVals, zVals, rFolded, zFolded, rIndex, zIndex)) {
+        return gemm_method(rFolded, zFolded).submat(rIndex, zIndex);
+    }
+    Chrono local("gemm_method");
+    arma::mat rPairs, zPairs;
+    pair_tables(rVals, zVals, rPairs, zPairs);
+    if (hoist_envelope) {
+        return (rPairs*zPairs.t())%(basis.rEnvelope(rVals)*basis.zEnvelope(zVals).t());
+    }
+    return rPairs*zPairs.t();
+}
+
+/**
+ * The tiles are independent blocks of rPairs * zPairs^T: the tile (i, j) only needs the rows of
+ * rPairs in the r range i and the rows of zPairs in the z range j, so each tile builds them
+ * from its own BasisTable and no table of the whole grid is ever stored.
+ */
+arma::mat NuclearDensityCalculator::tiled_method(const arma::vec& rVals, const arma::vec& zVals) const
+{
+    arma::vec rFolded, zFolded;
+    arma::uvec rIndex, zIndex;
+    if (fold_grid(rVals, zVals, rFolded, zFolded, rIndex, zIndex)) {
+        return tiled_method(rFolded, zFolded).submat(rIndex, zIndex);
+    }
+    Chrono local("tiled_method");
+    const arma::uword tile(tile_size>0 ? tile_size : grid_tile_size(pair_count()));
+    const int rTiles((rVals.n_elem+tile-1)/tile);
+    const int zTiles((zVals.n_elem+tile-1)/tile);
+    const arma::vec rEnvelope(hoist_envelope ? basis.rEnvelope(rVals) : arma::vec());
+    const arma::vec zEnvelope(hoist_envelope ? basis.zEnvelope(zVals) : arma::vec());
+
+    arma::mat result(rVals.n_elem, zVals.n_elem);
+#pragma omp parallel for schedule(dynamic) default(shared)
+    for (int t = 0; t<rTiles*zTiles; t++) {
+        const arma::uword r_first((t/zTiles)*tile);
+        const arma::uword z_first((t%zTiles)*tile);
+        const arma::uword r_last(std::min<arma::uword>(rVals.n_elem, r_first+tile)-1);
+        const arma::uword z_last(std::min<arma::uword>(zVals.n_elem, z_first+tile)-1);
+        arma::mat rPairs, zPairs;
+        pair_tables(rVals.subvec(r_first, r_last), zVals.subvec(z_first, z_last), rPairs, zPairs);
+        if (hoist_envelope) {
+            result.submat(r_first, z_first, r_last, z_last) =
+                    (rPairs*zPairs.t())%(rEnvelope.subvec(r_first, r_last)*zEnvelope.subvec(z_first, z_last).t());
+        }
+        else {
+            result.submat(r_first, z_first, r_last, z_last) = rPairs*zPairs.t();
+        }
+    }
+    return result;
+}
+
+int NuclearDensityCalculator::pair_count() const
+{
+    int pairs = 0;
+    for (int m = 0; m<basis.mMax; m++) {
+        pairs += rho_blocks.is_symmetric() ? basis.nMax(m)*(basis.nMax(m)+1)/2 : basis.nMax(m)*basis.nMax(m);
+    }
+    return pairs;
+}
+
+void NuclearDensityCalculator::pair_tables(const arma::vec& rVals, const arma::vec& zVals, arma::mat& rPairs, arma::mat& zPairs) const
+{
+    const BasisTable table(br, bz, N, Q, rVals, zVals, !hoist_envelope);
+    const arma::mat& zTable(table.z_parts());
+
+    const bool symmetric(rho_blocks.is_symmetric());
+    rPairs.set_size(rVals.n_elem, pair_count());
+    zPairs.set_size(zVals.n_elem, pair_count());
+
+    int p = 0;
+    for (int m = 0; m<basis.mMax; m++) {
+        const int nmax(basis.nMax(m));
+        const arma::mat& rho_m(rho_blocks.block(m));
+
+        for (int n_a = 0; n_a<nmax; n_a++) {
+            const int nz_amax(basis.n_zMax(m, n_a));
+            const arma::uword row(rho_blocks.offset(m, n_a));
+            const arma::uword first_col(symmetric ? row : 0);
+            /* zPart(nz_a) contracted with the rows of rho belonging to (m, n_a) */
+            const arma::mat z_rho(zTable.head_cols(nz_amax)*rho_m.submat(row, first_col, row+nz_amax-1, rho_m.n_cols-1));
+            for (int n_b = symmetric ? n_a : 0; n_b<nmax; n_b++) {
+                const int nz_bmax(basis.n_zMax(m, n_b));
+                const arma::uword col(rho_blocks.offset(m, n_b)-first_col);
+                const double count(symmetric && n_b!=n_a ? 2.0 : 1.0);
+                rPairs.col(p) = count*(table.rPart(m, n_a)%table.rPart(m, n_b));
+                zPairs.col(p) = arma::sum(z_rho.cols(col, col+nz_bmax-1)%zTable.head_cols(nz_bmax), 1);
+                p++;
+            }
+        }
+    }
+}
+
+/**
+ * For each block, \f$ \phi_k(r, z) = \sum_n R_{m n}(r) \, c_{n k}(z) \f$ with
+ * \f$ c_{n k} = \sum_{n_z} U_{(n, n_z), k} Z_{n_z} \f$, so every orbital on the whole grid
+ * is the product of the r table with the matrix of its c coefficients.
+ */
+arma::mat NuclearDensityCalculator::natural_orbitals_method(const arma::vec& rVals, const arma::vec& zVals, const double threshold) const
+{
+    arma::vec rFolded, zFolded;
+    arma::uvec rIndex, zIndex;
+    if (fold_grid(rVals, zVals, rFolded, zFolded, rIndex, zIndex)) {
+        return natural_orbitals_method(rFolded, zFolded, threshold).submat(rIndex, zIndex);
+    }
+    Chrono local("natural_orbitals_method");
+    const BasisTable table(br, bz, N, Q, rVals, zVals, !hoist_envelope);
+    const arma::mat& zTable(table.z_parts());
+
+    arma::mat result(arma::zeros(rVals.n_elem, zVals.n_elem));
+    for (int m = 0; m<basis.mMax; m++) {
+        const int nmax(basis.nMax(m));
+        const arma::uvec kept(arma::find(arma::abs(occupations[m])>=threshold));
+        if (kept.is_empty()) {
+            continue;
+        }
+        const arma::mat orbitals(natural_orbitals[m].cols(kept));
+        const arma::mat rTable(table.r_block(m));
+
+        /* coefs.slice(n) holds c_{n k}(z) for all the kept orbitals */
+        arma::cube coefs(zVals.n_elem, kept.n_elem, nmax);
+        for (int n = 0; n<nmax; n++) {
+            const int nz_max(basis.n_zMax(m, n));
+            coefs.slice(n) = zTable.head_cols(nz_max)*orbitals.rows(rho_blocks.offset(m, n), rho_blocks.offset(m, n)+nz_max-1);
+        }
+
+        arma::mat c_k(zVals.n_elem, nmax);
+        for (arma::uword k = 0; k<kept.n_elem; k++) {
+            for (int n = 0; n<nmax; n++) {
+                c_k.col(n) = coefs.slice(n).col(k);
+            }
+            const arma::mat phi(rTable*c_k.t());
+            result += occupations[m](kept(k))*arma::square(phi);
+        }
+    }
+    if (hoist_envelope) {
+        result %= basis.rEnvelope(rVals)*basis.zEnvelope(zVals).t();
+    }
+    return result;
+}
+
+/**
+ * At a single point the density is \f$ \Psi_m^T \rho_m \Psi_m \f$ where \f$ \Psi_m \f$ holds the
+ * basis functions of the block m, so for a chunk of points it is the row wise sum of
+ * \f$ (\Psi_m \rho_m) \% \Psi_m \f$ with one point per row of \f$ \Psi_m \f$.
+ */
+arma::vec NuclearDensityCalculator::evaluate_points(const arma::mat& rz) const
+{
+    Chrono local("evaluate_points");
+    if (rz.n_cols!=2) {
+        throw std::invalid_argument("evaluate_points expects one (r, z) point per row");
+    }
+    const int nPoints(rz.n_rows);
+    const int nChunks((nPoints+POINTS_CHUNK_SIZE-1)/POINTS_CHUNK_SIZE);
+
+    arma::vec result(nPoints);
+#pragma omp parallel for schedule(dynamic) default(shared)
+    for (int c = 0; c<nChunks; c++) {
+        const arma::uword first(c*POINTS_CHUNK_SIZE);
+        const arma::uword last(std::min(nPoints, (c+1)*POINTS_CHUNK_SIZE)-1);
+        const arma::vec rChunk(rz.col(0).rows(first, last));
+        const arma::vec zChunk(rz.col(1).rows(first, last));
+        const BasisTable table(br, bz, N, Q, rChunk, zChunk, !hoist_envelope);
+
+        arma::vec density(arma::zeros(rChunk.n_elem));
+        for (int m = 0; m<basis.mMax; m++) {
+            arma::mat psi(rChunk.n_elem, rho_blocks.dim(m));
+            for (int n = 0; n<basis.nMax(m); n++) {
+                for (int n_z = 0; n_z<basis.n_zMax(m, n); n_z++) {
+                    psi.col(rho_blocks.offset(m, n)+n_z) = table.rPart(m, n)%table.zPart(n_z);
                 }
-                all_rpart += mbnb_rpart%mana_rpart;
             }
-            tmp += all_rpart*nzb_zpart;
+            density += arma::sum((psi*rho_blocks.block(m))%psi, 1);
         }
-        builder->push(tmp%(unit*nza_zpart));
+        if (hoist_envelope) {
+            density %= basis.rEnvelope(rChunk)%basis.zEnvelope(zChunk);
+        }
+        result.rows(first, last) = density;
     }
-    return builder->GetResult(); /* Computes pending operations and returns the result of the accumulator */
+    return result;
+}
+
+double NuclearDensityCalculator::truncation_error(const double threshold) const
+{
+    double error = 0.0;
+    for (const arma::vec& occ : occupations) {
+        const arma::vec abs_occ(arma::abs(occ));
+        error += arma::accu(abs_occ.elem(arma::find(abs_occ<threshold)));
+    }
+    return error;
 }
 
 /**
  *
  */
 NuclearDensityCalculator::NuclearDensityCalculator()
-        :basis(br, bz, N, Q)
+        :NuclearDensityCalculator(NucleusStore::get(1.935801664793151, 2.829683956491218, 14, 1.3, default_rho_file())) { }
+
+NuclearDensityCalculator::NuclearDensityCalculator(double BR, double BZ, int basisN, double basisQ, const arma::mat& rho)
+        :NuclearDensityCalculator(NucleusStore::get(BR, BZ, basisN, basisQ, rho)) { }
+
+NuclearDensityCalculator::NuclearDensityCalculator(double BR, double BZ, int basisN, double basisQ,
+        const std::shared_ptr<const RhoFile>& file)
+        :NuclearDensityCalculator(NucleusStore::get(BR, BZ, basisN, basisQ, file)) { }
+
+NuclearDensityCalculator::NuclearDensityCalculator(const std::shared_ptr<const Nucleus>& shared)
+        :nucleus(shared), N(shared->N), Q(shared->Q), br(shared->br), bz(shared->bz),
+         rho_blocks(shared->rho_blocks), plan(shared->plan), occupations(shared->occupations),
+         natural_orbitals(shared->natural_orbitals), basis(shared->basis) { }
+
+NuclearDensityCalculator NuclearDensityCalculator::from_file(double BR, double BZ, int basisN, double basisQ, const std::string& path)
+{
+    return NuclearDensityCalculator(NucleusStore::get(BR, BZ, basisN, basisQ, path));
+}
+
+/**
+ */
+inline double NuclearDensityCalculator::rho(int m, int n, int n_z, int mp, int np, int n_zp) const
+{
+    if (m!=mp) {
+        return 0.0;
+    }
+    return rho_blocks(m, n, n_z, np, n_zp);
+}
+
+void NuclearDensityCalculator::set_envelope_hoisting(const bool enable)
+{
+    hoist_envelope = enable;
+}
+
+void NuclearDensityCalculator::set_deterministic(const bool enable)
+{
+    deterministic = enable;
+}
+
+void NuclearDensityCalculator::set_tile_size(const arma::uword size)
+{
+    tile_size = size;
+}
+
+/**
+ * The binary file written by rhoConvert is mapped instead of parsed (its symmetric blocks are unpacked
+ * once at load), but a rho.bin older than rho.arma was converted from a previous version of it and is ignored.
+ */
+std::string NuclearDensityCalculator::default_rho_file()
+{
+    struct stat binary{}, text{};
+    if (access("src/rho.bin", R_OK)!=0 || stat("src/rho.bin", &binary)!=0) {
+        return "src/rho.arma";
+    }
+    if (stat("src/rho.arma", &text)==0 && binary.st_mtime<text.st_mtime) {
+        std::cerr << "src/rho.bin is older than src/rho.arma and is ignored, run make src/rho.bin to update it" << std::endl;
+        return "src/rho.arma";
+    }
+    return "src/rho.bin";
+}
+
+arma::uword NuclearDensityCalculator::grid_tile_size(const arma::uword pairs)
 {
-    imported_rho_values.load("src/rho.arma", arma::arma_ascii);
-#ifdef DEBUG
-    std::cout << "[src/rho.arma defs imported]" << std::endl;
+    long cache(-1);
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
 #endif
-    ind = arma::Cube<arma::sword>(basis.n_zMax.max(), basis.nMax.max(), basis.mMax);
-    int i = 0;
-    for (int m = 0; m<basis.mMax; m++) {
-        for (int n = 0; n<basis.nMax.at(m); n++) {
-            for (int n_z = 0; n_z<basis.n_zMax.at(m, n); n_z++) {
-                ind.at(n_z, n, m) = i++;
-            }
+    if (cache<=0) {
+        cache = DEFAULT_L2_CACHE_SIZE;
+    }
+    /* a tile x tile block of the result and tile rows of both pair tables in half of the cache */
+    const double budget(cache/(2.0*sizeof(double)));
+    const double side(std::sqrt(static_cast<double>(pairs*pairs)+budget)-pairs);
+    return std::max<arma::uword>(8, static_cast<arma::uword>(side));
+}
+
+arma::uvec NuclearDensityCalculator::unique_values(const arma::vec& vals, arma::vec& unique_vals)
+{
+    const arma::uvec order(arma::sort_index(vals));
+    const double tolerance(vals.is_empty() ? 0.0 : 1e-12*std::max(1.0, arma::abs(vals).max()));
+    arma::uvec index(vals.n_elem);
+    std::vector<double> distinct;
+    for (const arma::uword i : order) {
+        if (distinct.empty() || vals(i)-distinct.back()>tolerance) {
+            distinct.push_back(vals(i));
         }
+        index(i) = distinct.size()-1;
     }
+    unique_vals = arma::vec(distinct);
+    return index;
 }
 
 /**
+ * rPart(m, n) is \f$ r^m \f$ times a function of \f$ r^2 \f$ and only products of two r parts with
+ * the same m appear in the density, so it only depends on |r|.
  */
-inline double NuclearDensityCalculator::rho(int m, int n, int n_z, int mp, int np, int n_zp) const
+arma::uvec NuclearDensityCalculator::fold_axis(const arma::vec& vals, arma::vec& folded)
+{
+    return unique_values(arma::abs(vals), folded);
+}
+
+/**
+ * If rho conserves parity every term of the density is even in z, so the z axis is folded like the r one.
+ */
+bool NuclearDensityCalculator::fold_grid(const arma::vec& rVals, const arma::vec& zVals, arma::vec& rFolded, arma::vec& zFolded,
+        arma::uvec& rIndex, arma::uvec& zIndex) const
 {
-    return imported_rho_values.at(ind.at(n_z, n, m), ind.at(n_zp, np, mp));
+    rIndex = fold_axis(rVals, rFolded);
+    if (rho_blocks.conserves_parity()) {
+        zIndex = fold_axis(zVals, zFolded);
+    }
+    else {
+        zFolded = zVals;
+        zIndex = arma::linspace<arma::uvec>(0, zVals.n_elem-1, zVals.n_elem);
+    }
+    return rFolded.n_elem<rVals.n_elem || zFolded.n_elem<zVals.n_elem;
 }
 
 void NuclearDensityCalculator::printRhoDefs()
@@ -192,3 +506,94 @@ arma::cube  NuclearDensityCalculator::density_cartesian(const int xyPoints, cons
     }
     return cube;
 }
+
+/**
+ * The radii of all the (x, y) pairs are merged when they are equal up to rounding,
+ * which happens for (x, y), (-x, y), (y, x) ... on symmetric axes.
+ */
+arma::uvec NuclearDensityCalculator::distinct_radii(const arma::vec& xVals, const arma::vec& yVals, arma::vec& radii)
+{
+    const arma::uword xSize(xVals.n_elem), ySize(yVals.n_elem);
+    arma::vec all_radii(xSize*ySize);
+    for (arma::uword y = 0; y<ySize; y++) {
+        for (arma::uword x = 0; x<xSize; x++) {
+            all_radii(y*xSize+x) = std::hypot(xVals(x), yVals(y));
+        }
+    }
+    return unique_values(all_radii, radii);
+}
+
+arma::cube NuclearDensityCalculator::density_cartesian(const arma::vec& xVals, const arma::vec& yVals, const arma::vec& zVals) const
+{
+    Chrono local("density_cartesian");
+    const arma::uword xSize(xVals.n_elem), ySize(yVals.n_elem), zSize(zVals.n_elem);
+    arma::vec radii;
+    const arma::uvec radius_index(distinct_radii(xVals, yVals, radii));
+    const arma::mat density(gemm_method(radii, zVals));
+
+    arma::cube cube(xSize, ySize, zSize);
+#pragma omp parallel for default(shared)
+    for (arma::uword z = 0; z<zSize; z++) {
+        const double* column(density.colptr(z));
+        double* slice(cube.slice_memptr(z));
+        for (arma::uword i = 0; i<xSize*ySize; i++) {
+            slice[i] = column[radius_index(i)];
+        }
+    }
+    return cube;
+}
+
+/**
+ * Every voxel is a value of the (r, z) density, so the maximum of the volume is the maximum of the
+ * density on the distinct radii. The density is evaluated with tiled_method DF3_SLICES_PER_CHUNK
+ * z values at a time, a first time to find the maximum and a second time to write the slices,
+ * so neither the volume nor the density on all the slices is ever in memory.
+ */
+void NuclearDensityCalculator::density_cartesian_df3(const arma::vec& xVals, const arma::vec& yVals, const arma::vec& zVals,
+        const std::string& filename, const int bits) const
+{
+    Chrono local("density_cartesian_df3");
+    const arma::uword xSize(xVals.n_elem), ySize(yVals.n_elem), zSize(zVals.n_elem);
+    arma::vec radii;
+    const arma::uvec radius_index(distinct_radii(xVals, yVals, radii));
+    const arma::uword chunks((zSize+DF3_SLICES_PER_CHUNK-1)/DF3_SLICES_PER_CHUNK);
+
+    double max(-arma::datum::inf);
+    for (arma::uword c = 0; c<chunks && !radii.is_empty(); c++) {
+        const arma::uword first(c*DF3_SLICES_PER_CHUNK);
+        const arma::uword last(std::min<arma::uword>(zSize, first+DF3_SLICES_PER_CHUNK)-1);
+        max = std::max(max, tiled_method(radii, zVals.subvec(first, last)).max());
+    }
+    const Df3Writer writer(filename, xSize, ySize, zSize, max, bits);
+
+    /* an exception can not leave a parallel region, the first one is thrown after it */
+    std::exception_ptr error;
+    for (arma::uword c = 0; c<chunks && !radii.is_empty(); c++) {
+        const arma::uword first(c*DF3_SLICES_PER_CHUNK);
+        const arma::uword last(std::min<arma::uword>(zSize, first+DF3_SLICES_PER_CHUNK)-1);
+        const arma::mat density(tiled_method(radii, zVals.subvec(first, last)));
+#pragma omp parallel default(shared)
+        {
+            std::vector<double> slice(xSize*ySize); /* one slice per thread, reused */
+#pragma omp for
+            for (arma::uword z = first; z<=last; z++) {
+                const double* column(density.colptr(z-first));
+                for (arma::uword i = 0; i<xSize*ySize; i++) {
+                    slice[i] = column[radius_index(i)];
+                }
+                try {
+                    writer.write_slice(z, slice.data());
+                }
+                catch (...) {
+#pragma omp critical
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
@@ -6,19 +6,42 @@
 #define PROJET_IPS1_NUCLEARDENSITYCALCULATOR_H
 
 #include "Basis.h"
+#include "RhoBlocks.h"
+#include "DensityPlan.h"
+#include "RhoFile.h"
+#include "NucleusStore.h"
 #include "constants.h"
 
+#include <memory>
+#include <string>
+
 /**
  * @class NuclearDensityCalculator
  */
 class NuclearDensityCalculator {
 private:
-    const int N = 14; /** truncation parameter */
-    const double Q = 1.3; /** truncation parameter */
-    const double br = 1.935801664793151; /** radius deformation factor */
-    const double bz = 2.829683956491218; /** z deformation factor */
-    arma::mat imported_rho_values; /** rho values from file */
-    Basis basis; /** basis of functions */
+    std::shared_ptr<const Nucleus> nucleus; /** basis, rho and plan, shared with the other calculators of the same nucleus */
+    const int N; /** truncation parameter */
+    const double Q; /** truncation parameter */
+    const double br; /** radius deformation factor */
+    const double bz; /** z deformation factor */
+    const RhoBlocks& rho_blocks; /** per m blocks of the rho values from file */
+    const DensityPlan& plan; /** factorised sum of optimized_method3, compiled once from the basis and rho */
+    const std::vector<arma::vec>& occupations; /** eigenvalues of each block of rho, in ascending order */
+    const std::vector<arma::mat>& natural_orbitals; /** eigenvectors of each block of rho, one per column */
+    bool hoist_envelope = false; /** if true the gaussian factors are applied once at the end of the sums */
+    bool deterministic = false; /** if true optimized_method3 gives the same bits whatever the number of threads */
+    arma::uword tile_size = 0; /** side of the grid tiles of tiled_method, 0 to derive it from the L2 cache size */
+    const Basis& basis; /** basis of functions */
+
+    /**
+     * Distinct radii of a cartesian (x, y) grid
+     * @param xVals vector of x values
+     * @param yVals vector of y values
+     * @param radii output, the distinct radii in ascending order
+     * @return for the point (x, y) at y * xVals.n_elem + x, the index of its radius in radii
+     */
+    static arma::uvec distinct_radii(const arma::vec& xVals, const arma::vec& yVals, arma::vec& radii);
 
     /**
      * Computes the value of rho for the given
@@ -32,28 +55,152 @@ private:
      * @param n_zp quantum number of b
      *
      * @warning For now just returns hard coded values because
-     * we dont know how to compute them.
+     * we dont know how to compute them. The terms with m != mp are null.
      * @return rho(n, m, n_z, np, mp, n_zp)
      */
     inline double rho(int m, int n, int n_z, int mp, int np, int n_zp) const;
 
+    /**
+     * Sorts the values and merges the ones that are equal up to rounding
+     * @param vals values to merge
+     * @param unique_vals output, the distinct values in ascending order
+     * @return for each value of vals, the index of its representative in unique_vals
+     */
+    static arma::uvec unique_values(const arma::vec& vals, arma::vec& unique_vals);
+
+    /**
+     * The density is even in r, so an r axis only needs to be evaluated on its distinct |r| values
+     * @param vals values of the axis
+     * @param folded output, the distinct absolute values of the axis
+     * @return for each value of vals, the index of its absolute value in folded
+     */
+    static arma::uvec fold_axis(const arma::vec& vals, arma::vec& folded);
+
+    /**
+     * Folds the r axis and, if rho conserves parity, the z axis
+     * @param rVals vector of r values
+     * @param zVals vector of z values
+     * @param rFolded output, r values to evaluate
+     * @param zFolded output, z values to evaluate
+     * @param rIndex output, row of rFolded for each value of rVals
+     * @param zIndex output, column of zFolded for each value of zVals
+     * @return true if the folded grid is smaller than the requested one
+     */
+    bool fold_grid(const arma::vec& rVals, const arma::vec& zVals, arma::vec& rFolded, arma::vec& zFolded,
+            arma::uvec& rIndex, arma::uvec& zIndex) const;
+
+    /**
+     * Builds the tables of gemm_method, the density being rPairs * zPairs^T
+     * @param rVals vector of r values
+     * @param zVals vector of z values
+     * @param rPairs output, one column per (m, n_a, n_b) pair with \f$ R_{m n_a} R_{m n_b} \f$ times its count
+     * @param zPairs output, the matching column of z parts contracted with rho
+     */
+    void pair_tables(const arma::vec& rVals, const arma::vec& zVals, arma::mat& rPairs, arma::mat& zPairs) const;
+
+    /**
+     * @return the number of columns of the pair tables, one per (m, n_a, n_b) or per (m, n_a <= n_b) if rho is symmetric
+     */
+    int pair_count() const;
+
+    /**
+     * Side of the square tiles of tiled_method, such that a tile of the result and the rows of
+     * the pair tables it reads fill about half of the L2 cache
+     * @param pairs number of columns of the pair tables
+     * @return the tile side, in grid points
+     */
+    static arma::uword grid_tile_size(arma::uword pairs);
+
+    /**
+     * @return src/rho.bin if it is readable and not older than src/rho.arma, else src/rho.arma
+     */
+    static std::string default_rho_file();
+
+    /**
+     * Calculator of a nucleus of the store
+     * @param shared the nucleus
+     */
+    explicit NuclearDensityCalculator(const std::shared_ptr<const Nucleus>& shared);
+
 public:
 
     /**
-     * Default constructor that uses hard coded valued for rho and basis truncation
+     * Default constructor that uses hard coded valued for rho and basis truncation.
+     * rho is mapped from src/rho.bin if it exists and is up to date, else read from src/rho.arma.
+     * Every constructor takes the nucleus from the NucleusStore, so the calculators of the same
+     * nucleus only load and compile it once and share it.
      */
     NuclearDensityCalculator();
 
+    /**
+     * Calculator of the density of any nucleus, for a density matrix already in memory
+     * @param BR Basis deformation along radius
+     * @param BZ Basis deformation along z axis
+     * @param basisN Basis truncation parameter
+     * @param basisQ Basis truncation parameter
+     * @param rho full density matrix, its rows and columns ordered by m, n, n_z
+     * @throw std::invalid_argument if rho does not have one row and one column per state of the basis
+     */
+    NuclearDensityCalculator(double BR, double BZ, int basisN, double basisQ, const arma::mat& rho);
+
+    /**
+     * Calculator of the density of any nucleus, for a mapped binary rho file, whose blocks are not parsed
+     * @param BR Basis deformation along radius
+     * @param BZ Basis deformation along z axis
+     * @param basisN Basis truncation parameter
+     * @param basisQ Basis truncation parameter
+     * @param file mapped file, kept alive by the calculator
+     * @throw std::invalid_argument if the file was not written for this basis
+     */
+    NuclearDensityCalculator(double BR, double BZ, int basisN, double basisQ, const std::shared_ptr<const RhoFile>& file);
+
+    /**
+     * Calculator of the density of any nucleus, for a rho file in the binary format or saved with arma_ascii.
+     * The binary files are recognised by their header and mapped, the other ones are parsed.
+     * @param BR Basis deformation along radius
+     * @param BZ Basis deformation along z axis
+     * @param basisN Basis truncation parameter
+     * @param basisQ Basis truncation parameter
+     * @param path path of the rho file, absolute or relative to the working directory
+     * @throw std::runtime_error if the file can not be read
+     * @throw std::invalid_argument if rho does not match the basis
+     * @return the calculator
+     */
+    static NuclearDensityCalculator from_file(double BR, double BZ, int basisN, double basisQ, const std::string& path);
+
+    /**
+     * @return the nucleus used by the calculator, shared with the other calculators of the same nucleus
+     */
+    inline std::shared_ptr<const Nucleus> shared_nucleus() const { return nucleus; }
+
     /**
      * @see https://dubrayn.github.io/IPS-PROD/project.html#19
      */
     void printRhoDefs();
 
     /**
-     * Cube to hold the correspondance between the 2D matrix of rho values provided by the teacher
-     * and the 6D space we're addressing it from
+     * Every term of the density carries the same gaussian factor \f$ e^{-r^2/b_r^2 - z^2/b_z^2} \f$.
+     * If enabled, optimized_method3, gemm_method and natural_orbitals_method only sum the polynomial
+     * parts of the basis functions and multiply by this factor once per grid point.
+     * @param enable true to hoist the gaussian factor out of the sums
+     */
+    void set_envelope_hoisting(bool enable);
+
+    /**
+     * optimized_method3 splits its terms into partial sums that are merged by a fixed tree.
+     * By default there is one partial sum per thread, so the result only depends on the number
+     * of threads. In deterministic mode there are DETERMINISTIC_CHUNKS of them, or one per n_za
+     * group of the DensityPlan if there are fewer groups, which makes the result bitwise identical
+     * on any number of threads, for the price of that many grid sized buffers and a deeper merge.
+     * @param enable true to make optimized_method3 independent of the number of threads
      */
-    arma::icube ind;
+    void set_deterministic(bool enable);
+
+    /**
+     * Overrides the side of the grid tiles used by tiled_method
+     * @param size tile side in grid points, 0 to derive it from the L2 cache size
+     */
+    void set_tile_size(arma::uword size);
 
     /**
      * Naive method seen in the class
@@ -83,16 +230,71 @@ public:
 
     /**
      * Most optimized method.
-     * It uses the memoised version of the class Basis.
-     * It uses multithreading with openMP but can be ported to use native threads
-     * It uses the factorisation helper to extract the four sub_sums from the
-     * naive one.
+     * It walks the DensityPlan compiled once from the basis and rho, which holds the four
+     * nested sub_sums factored out of the naive one, and reads the basis functions from a
+     * BasisTable built once for the grid and shared read only by the threads.
+     * It uses multithreading with openMP, the n_za groups of the plan being split in partial
+     * sums merged by a TreeReducer.
      * @param rVals vector of r values (radius)
      * @param zVals vector of z values
      * @return a matrix of density values for rVals x zVals (cartesian products giving coordinates)
      */
     arma::mat optimized_method3(const arma::vec& rVals, const arma::vec& zVals) const;
 
+    /**
+     * Dense linear algebra method.
+     * For each m block, the r parts and the z parts are stored as columns of two tables
+     * so that the rho contraction and the final sum over the (n_a, n_b) pairs are
+     * done with matrix products (BLAS-3) instead of one outer product per basis pair.
+     * @param rVals vector of r values (radius)
+     * @param zVals vector of z values
+     * @return a matrix of density values for rVals x zVals (cartesian products giving coordinates)
+     */
+    arma::mat gemm_method(const arma::vec& rVals, const arma::vec& zVals) const;
+
+    /**
+     * Same contraction as gemm_method, scheduled over the output grid instead of the basis.
+     * The (r, z) grid is cut into tiles sized to the L2 cache and each thread owns whole tiles,
+     * building the basis functions and the rho contraction of every basis pair on its tile only,
+     * so no thread shares an output value, there is no reduction and the memory used by a thread
+     * only depends on the tile size.
+     * @see set_tile_size
+     * @param rVals vector of r values (radius)
+     * @param zVals vector of z values
+     * @return a matrix of density values for rVals x zVals (cartesian products giving coordinates)
+     */
+    arma::mat tiled_method(const arma::vec& rVals, const arma::vec& zVals) const;
+
+    /**
+     * Natural orbitals method.
+     * Each block of rho is diagonalised at load time, rho_m = U diag(occ) U^T, so the density is
+     * \f$ \sum_{m, k} occ_k \, \phi_k(r, z)^2 \f$ where \f$ \phi_k \f$ is a combination of the basis
+     * functions of the block m. The orbitals with |occ_k| < threshold are dropped.
+     * @param rVals vector of r values (radius)
+     * @param zVals vector of z values
+     * @param threshold smallest |occupation| of the orbitals kept, 0 keeps all of them and is exact
+     * @return a matrix of density values for rVals x zVals (cartesian products giving coordinates)
+     * @see truncation_error for the error made by dropping orbitals
+     */
+    arma::mat natural_orbitals_method(const arma::vec& rVals, const arma::vec& zVals, double threshold = 0.0) const;
+
+    /**
+     * Evaluates the density on scattered points instead of a tensor product grid.
+     * The points are processed in chunks of POINTS_CHUNK_SIZE, in parallel, and the basis
+     * functions are only computed on the points of the chunk.
+     * @param rz matrix with one point per row, r in the first column and z in the second one
+     * @return the density at each point
+     */
+    arma::vec evaluate_points(const arma::mat& rz) const;
+
+    /**
+     * The natural orbitals are normalised, so dropping the orbital k changes the integral of
+     * |density| by at most |occ_k|.
+     * @param threshold same as in natural_orbitals_method
+     * @return the sum of |occ_k| over the dropped orbitals, a bound of the integrated absolute error
+     */
+    double truncation_error(double threshold) const;
+
     /**
     * @brief Convert the density form cylindric to cartesian coordinates
     * @param xyPoints the number of points on x and y axis
@@ -102,6 +304,34 @@ public:
     * @return a cube containing the density in cartesian coordinates
     */
     arma::cube static density_cartesian(int xyPoints, int zPoints, const arma::vec& rVals, const arma::mat& res) ;
+
+    /**
+     * @brief Evaluates the density directly on a cartesian grid
+     * The density only depends on \f$ r = \sqrt{x^2 + y^2} \f$, so it is computed once with gemm_method
+     * for each distinct radius of the grid, which only covers one octant of the x/y plane
+     * for the usual symmetric axes, and then copied to all the (x, y) pairs in parallel.
+     * @param xVals vector of x values
+     * @param yVals vector of y values
+     * @param zVals vector of z values
+     * @return a cube of density values for xVals x yVals x zVals
+     */
+    arma::cube density_cartesian(const arma::vec& xVals, const arma::vec& yVals, const arma::vec& zVals) const;
+
+    /**
+     * Same volume as density_cartesian, written to a df3 file slice by slice instead of being returned.
+     * The density on the distinct radii is evaluated twice, DF3_SLICES_PER_CHUNK slices at a time,
+     * once for the normalisation maximum and once for the voxels, so only one chunk of it and one
+     * slice per thread are in memory, whatever the number of slices.
+     * @param xVals vector of x values
+     * @param yVals vector of y values
+     * @param zVals vector of z values
+     * @param filename the name of the df3 file (must end with .df3)
+     * @param bits size of a voxel, 8, 16 or 32
+     * @throw std::invalid_argument if bits is not 8, 16 or 32
+     * @throw std::runtime_error if the file can not be written
+     */
+    void density_cartesian_df3(const arma::vec& xVals, const arma::vec& yVals, const arma::vec& zVals, const std::string& filename,
+            int bits = 8) const;
 };
 
 #endif //PROJET_IPS1_NUCLEARDENSITYCALCULATOR_H
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#include "NucleusStore.h"
+
+std::mutex NucleusStore::mutex;
+std::map<NucleusStore::key_type, std::weak_ptr<const Nucleus>> NucleusStore::nuclei;
+
+Nucleus::Nucleus(double BR, double BZ, int basisN, double basisQ, const arma::mat& rho)
+        :N(basisN), Q(basisQ), br(BR), bz(BZ), basis(br, bz, N, Q)
+{
+    arma::uword states = 0;
+    for (int m = 0; m<basis.mMax; m++) {
+        for (int n = 0; n<basis.nMax(m); n++) {
+            states += basis.n_zMax(m, n);
+        }
+    }
+    if (rho.n_rows!=states || rho.n_cols!=states) {
+        throw std::invalid_argument("rho is "+std::to_string(rho.n_rows)+"x"+std::to_string(rho.n_cols)
+                +" but the basis has "+std::to_string(states)+" states");
+    }
+    /* Only the m_a == m_b blocks are kept, the full matrix can be released by the caller */
+    rho_blocks = RhoBlocks(rho, basis);
+    compile();
+}
+
+Nucleus::Nucleus(double BR, double BZ, int basisN, double basisQ, const std::shared_ptr<const RhoFile>& file)
+        :N(basisN), Q(basisQ), br(BR), bz(BZ), basis(br, bz, N, Q)
+{
+    if (!file->matches(N, Q, br, bz)) {
+        throw std::invalid_argument("the rho file was written for another basis");
+    }
+    rho_blocks = RhoBlocks(file, basis);
+    compile();
+}
+
+void Nucleus::compile()
+{
+    plan = DensityPlan(basis, rho_blocks);
+
+    /* Only the symmetric part of rho contributes to the density, so it can always be diagonalised */
+    for (int m = 0; m<rho_blocks.size(); m++) {
+        const arma::mat& block(rho_blocks.block(m));
+        arma::vec occ;
+        arma::mat orbitals;
+        arma::eig_sym(occ, orbitals, arma::symmatu(0.5*(block+block.t())));
+        occupations.push_back(occ);
+        natural_orbitals.push_back(orbitals);
+    }
+}
+
+template<typename Builder>
+std::shared_ptr<const Nucleus> NucleusStore::find_or_build(const key_type& key, Builder build)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto found = nuclei.find(key);
+        if (found!=nuclei.end()) {
+            const std::shared_ptr<const Nucleus> shared(found->second.lock());
+            if (shared) {
+                return shared;
+            }
+        }
+    }
+    /* built without the lock, so that different nuclei are loaded concurrently */
+    const std::shared_ptr<const Nucleus> built(build());
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto entry = nuclei.begin(); entry!=nuclei.end();) {
+        entry = entry->second.expired() ? nuclei.erase(entry) : std::next(entry);
+    }
+    std::weak_ptr<const Nucleus>& stored(nuclei[key]);
+    const std::shared_ptr<const Nucleus> shared(stored.lock());
+    if (shared) {
+        return shared;
+    }
+    stored = built;
+    return built;
+}
+
+std::shared_ptr<const Nucleus> NucleusStore::get(double BR, double BZ, int N, double Q, const std::string& path)
+{
+    struct stat info{};
+    if (stat(path.c_str(), &info)!=0) {
+        throw std::runtime_error("cannot read the rho file "+path);
+    }
+    const std::string identity("file:"+std::to_string(info.st_dev)+":"+std::to_string(info.st_ino)+":"
+            +std::to_string(info.st_size)+":"+std::to_string(info.st_mtim.tv_sec)+"."+std::to_string(info.st_mtim.tv_nsec));
+    return find_or_build(key_type(identity, N, Q, BR, BZ), [&]() -> std::shared_ptr<const Nucleus> {
+        if (RhoFile::is_rho_file(path)) {
+            return std::make_shared<const Nucleus>(BR, BZ, N, Q, std::make_shared<const RhoFile>(path));
+        }
+        arma::mat imported_rho_values;
+        if (!imported_rho_values.load(path, arma::arma_ascii)) {
+            throw std::runtime_error("cannot read the rho file "+path);
+        }
+#ifdef DEBUG
+        std::cout << "[" << path << " defs imported]" << std::endl;
+#endif
+        return std::make_shared<const Nucleus>(BR, BZ, N, Q, imported_rho_values);
+    });
+}
+
+std::shared_ptr<const Nucleus> NucleusStore::get(double BR, double BZ, int N, double Q, const arma::mat& rho)
+{
+    const uint64_t hash(RhoFile::fnv1a(reinterpret_cast<const unsigned char*>(rho.memptr()), rho.n_elem*sizeof(double)));
+    const std::string identity("matrix:"+std::to_string(rho.n_rows)+"x"+std::to_string(rho.n_cols)+":"+std::to_string(hash));
+    return find_or_build(key_type(identity, N, Q, BR, BZ), [&]() -> std::shared_ptr<const Nucleus> {
+        return std::make_shared<const Nucleus>(BR, BZ, N, Q, rho);
+    });
+}
+
+std::shared_ptr<const Nucleus> NucleusStore::get(double BR, double BZ, int N, double Q, const std::shared_ptr<const RhoFile>& file)
+{
+    const std::string identity("rhofile:"+std::to_string(file->header().data_size)+":"+std::to_string(file->header().checksum));
+    return find_or_build(key_type(identity, N, Q, BR, BZ), [&]() -> std::shared_ptr<const Nucleus> {
+        return std::make_shared<const Nucleus>(BR, BZ, N, Q, file);
+    });
+}
+
+void NucleusStore::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    nuclei.clear();
+}
+
+size_t NucleusStore::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t alive = 0;
+    for (const auto& entry : nuclei) {
+        alive += entry.second.expired() ? 0 : 1;
+    }
+    return alive;
+}
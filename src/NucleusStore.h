@@ -0,0 +1,123 @@
+/**
+ * @file NucleusStore.h
+ */
+
+#ifndef PROJET_IPS1_NUCLEUSSTORE_H
+#define PROJET_IPS1_NUCLEUSSTORE_H
+
+#include <armadillo>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "Basis.h"
+#include "RhoBlocks.h"
+#include "RhoFile.h"
+#include "DensityPlan.h"
+
+/**
+ * @class Nucleus
+ * Everything a NuclearDensityCalculator derives from the basis and the density matrix of a nucleus.
+ * It is never modified after construction, so it is shared read only between calculators and threads.
+ */
+class Nucleus {
+public:
+    /**
+     * @param BR Basis deformation along radius
+     * @param BZ Basis deformation along z axis
+     * @param basisN Basis truncation parameter
+     * @param basisQ Basis truncation parameter
+     * @param rho full density matrix, ordered by m, n, n_z
+     * @throw std::invalid_argument if rho does not have one row and one column per state of the basis
+     */
+    Nucleus(double BR, double BZ, int basisN, double basisQ, const arma::mat& rho);
+
+    /**
+     * @param BR Basis deformation along radius
+     * @param BZ Basis deformation along z axis
+     * @param basisN Basis truncation parameter
+     * @param basisQ Basis truncation parameter
+     * @param file mapped binary rho file, its packed blocks are unpacked once at load
+     * @throw std::invalid_argument if the file was not written for this basis
+     */
+    Nucleus(double BR, double BZ, int basisN, double basisQ, const std::shared_ptr<const RhoFile>& file);
+
+    const int N; /**< truncation parameter */
+    const double Q; /**< truncation parameter */
+    const double br; /**< radius deformation factor */
+    const double bz; /**< z deformation factor */
+    const Basis basis; /**< basis of functions */
+    RhoBlocks rho_blocks; /**< per m blocks of rho */
+    DensityPlan plan; /**< factorised sum of optimized_method3 */
+    std::vector<arma::vec> occupations; /**< eigenvalues of each block of rho, in ascending order */
+    std::vector<arma::mat> natural_orbitals; /**< eigenvectors of each block of rho, one per column */
+
+private:
+    /**
+     * Compiles the DensityPlan and the natural orbitals once rho_blocks is set
+     */
+    void compile();
+};
+
+/**
+ * @class NucleusStore
+ * Process wide cache of the nuclei, so that the calculators of the same nucleus share one
+ * read only copy of its basis, rho and plan instead of loading and compiling it again.
+ *
+ * The nuclei are keyed by the basis parameters and by the identity of their rho: the device,
+ * inode, size and modification time of a file, or a hash of the content of a matrix or of a
+ * mapped RhoFile. All the functions can be called concurrently. The store only holds weak
+ * references, so a nucleus is freed with its last calculator and built again if it is asked for
+ * later, and the expired entries are pruned whenever a nucleus is inserted.
+ */
+class NucleusStore {
+public:
+    /**
+     * @param path rho file, in the binary format or saved with arma_ascii
+     * @throw std::runtime_error if the file can not be read
+     * @throw std::invalid_argument if rho does not match the basis
+     * @return the nucleus, loaded only if the store does not have it yet
+     */
+    static std::shared_ptr<const Nucleus> get(double BR, double BZ, int N, double Q, const std::string& path);
+
+    /**
+     * @param rho full density matrix, ordered by m, n, n_z
+     * @return the nucleus, compiled only if the store does not have the same matrix for this basis
+     */
+    static std::shared_ptr<const Nucleus> get(double BR, double BZ, int N, double Q, const arma::mat& rho);
+
+    /**
+     * @param file mapped binary rho file
+     * @return the nucleus, compiled only if the store does not have a file with the same content for this basis
+     */
+    static std::shared_ptr<const Nucleus> get(double BR, double BZ, int N, double Q, const std::shared_ptr<const RhoFile>& file);
+
+    /**
+     * Forgets every nucleus, they are freed when their last calculator is
+     */
+    static void clear();
+
+    /**
+     * @return the number of nuclei of the store still used by a calculator
+     */
+    static size_t size();
+
+private:
+    typedef std::tuple<std::string, int, double, double, double> key_type; /**< rho identity, N, Q, br, bz */
+
+    /**
+     * Looks the key up, and if it is missing or expired builds the nucleus without holding the lock.
+     * If two threads build the same nucleus, both get the one stored first.
+     * @tparam Builder callable returning a std::shared_ptr<const Nucleus>
+     */
+    template<typename Builder>
+    static std::shared_ptr<const Nucleus> find_or_build(const key_type& key, Builder build);
+
+    static std::mutex mutex; /**< protects nuclei */
+    static std::map<key_type, std::weak_ptr<const Nucleus>> nuclei; /**< the cached nuclei */
+};
+
+#endif //PROJET_IPS1_NUCLEUSSTORE_H
@@ -1,50 +1,213 @@
 #include "Poly.h"
 
-void Poly::calcHermite(uint nMax, const arma::vec &vec) {
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+void Poly::hermiteCoefficients(int i, bool normalised, double &a, double &c) {
+    const double di(static_cast<double>(i));
+    a = normalised ? std::sqrt(2. / di) : 2.;
+    c = normalised ? std::sqrt((di - 1.) / di) : 2. * (di - 1.);
+}
+
+void Poly::laguerreCoefficients(int m, int n, bool normalised, double &alpha, double &scale, double &gamma) {
+    const double dm(static_cast<double>(m));
+    const double d(static_cast<double>(n));
+    scale = normalised ? 1. / std::sqrt(d * (d + dm)) : 1. / d;
+    alpha = (2. * d - 1. + dm) * scale;
+    gamma = normalised ? std::sqrt((d - 1.) * (d + dm - 1.) / (d * (d + dm))) : (d + dm - 1.) / d;
+}
+
+bool Poly::parallelBlocks(arma::uword blocks) {
+#ifdef _OPENMP
+    return !omp_in_parallel() && blocks >= POLY_PARALLEL_BLOCKS * static_cast<arma::uword>(omp_get_max_threads());
+#else
+    return false;
+#endif
+}
+
+void Poly::calcHermite(uint nMax, const arma::vec &vec, bool normalised) {
     /*
      * If the parameters are nonsense the matrix (0) is returned
      */
-    arma::uword rowLen(vec.size());
-    hermitePolynomial = arma::mat(nMax + 1, rowLen, arma::fill::zeros);
-    hermitePolynomial.row(0) = arma::vec(rowLen, arma::fill::ones).t();
-    if (nMax > 0) {
-        hermitePolynomial.row(1) = 2 * vec.t();
+    const arma::uword len(vec.size());
+    hermitePolynomial = arma::mat(len, nMax + 1);
+    const arma::uword blocks((len + POLY_BLOCK_SIZE - 1) / POLY_BLOCK_SIZE);
+    const double *x = vec.memptr();
+    double *h = hermitePolynomial.memptr();
+
+    /*
+     * H_0 = 1, H_1 = 2x, H_i = 2x H_{i-1} - 2(i-1) H_{i-2}
+     * or normalised: H_0 = 1, H_1 = sqrt(2) x, H_i = sqrt(2/i) x H_{i-1} - sqrt((i-1)/i) H_{i-2}
+     * on each block of points, the columns i-1 and i-2 of the block are still in cache
+     */
+    const double a1(normalised ? std::sqrt(2.) : 2.);
+#pragma omp parallel for if(parallelBlocks(blocks))
+    for (arma::uword b = 0; b < blocks; b++) {
+        const arma::uword first(b * POLY_BLOCK_SIZE);
+        const arma::uword last(std::min(len, first + POLY_BLOCK_SIZE));
+#pragma omp simd
+        for (arma::uword k = first; k < last; k++) {
+            h[k] = 1.;
+        }
+        if (nMax > 0) {
+#pragma omp simd
+            for (arma::uword k = first; k < last; k++) {
+                h[len + k] = a1 * x[k];
+            }
+        }
         for (uint i = 2; i <= nMax; i++) {
-            hermitePolynomial.row(i) =
-                    hermitePolynomial.row(1) % hermitePolynomial.row(i - 1) -
-                    2. * (static_cast<double>(i) - 1.) * hermitePolynomial.row(i - 2);
+            double *hi = h + i * len;
+            const double *hi1 = hi - len;
+            const double *hi2 = hi1 - len;
+            double a, c;
+            hermiteCoefficients(static_cast<int>(i), normalised, a, c);
+#pragma omp simd
+            for (arma::uword k = first; k < last; k++) {
+                hi[k] = a * x[k] * hi1[k] - c * hi2[k];
+            }
         }
     }
 }
 
 arma::vec Poly::hermite(int n)const {
-    return hermitePolynomial.row(n).as_col();
+    return hermitePolynomial.col(n);
+}
+
+void Poly::hermite(int n, double *out) const {
+    std::copy(hermitePolynomial.colptr(n), hermitePolynomial.colptr(n) + hermitePolynomial.n_rows, out);
 }
 
 arma::vec  Poly::laguerre(int m, int n)const {
-    return laguerrePolynomial.slice(n).row(m).as_col();
+    return laguerrePolynomial.col(laguerreOffsets(m) + n);
+}
+
+void Poly::laguerre(int m, int n, double *out) const {
+    const double *col = laguerrePolynomial.colptr(laguerreOffsets(m) + n);
+    std::copy(col, col + laguerrePolynomial.n_rows, out);
+}
+
+void Poly::calcLaguerre(int mMax, int nMax, const arma::vec &z, bool normalised) {
+    arma::ivec nMaxes(mMax);
+    nMaxes.fill(nMax);
+    calcLaguerre(nMaxes, z, normalised);
+}
+
+void Poly::calcLaguerre(const arma::ivec &nMax, const arma::vec &z, bool normalised) {
+    const arma::uword len(z.n_elem);
+    laguerreOffsets = arma::uvec(nMax.n_elem + 1);
+    laguerreOffsets(0) = 0;
+    for (arma::uword m = 0; m < nMax.n_elem; m++) {
+        laguerreOffsets(m + 1) = laguerreOffsets(m) + std::max<arma::sword>(nMax(m), 0);
+    }
+    laguerrePolynomial = arma::mat(len, laguerreOffsets(nMax.n_elem));
+
+    const arma::uword blocks((len + POLY_BLOCK_SIZE - 1) / POLY_BLOCK_SIZE);
+    const double *x = z.memptr();
+    double *l = laguerrePolynomial.memptr();
+
+    /*
+     * L_0 = 1, L_1 = 1 + m - z and
+     * L_n = (2 + (m - z - 1) / n) L_{n-1} - (1 + (m - 1) / n) L_{n-2}
+     * or normalised: L_0 = 1 / sqrt(m!), L_1 = (1 + m - z) / sqrt(m + 1) L_0 and
+     * L_n = (2n - 1 + m - z) / sqrt(n (n + m)) L_{n-1} - sqrt((n - 1) (n + m - 1) / (n (n + m))) L_{n-2}
+     * for each block of points and each m, only the two previous columns of the block are read
+     */
+#pragma omp parallel for if(parallelBlocks(blocks))
+    for (arma::uword b = 0; b < blocks; b++) {
+        const arma::uword first(b * POLY_BLOCK_SIZE);
+        const arma::uword last(std::min(len, first + POLY_BLOCK_SIZE));
+        for (arma::uword m = 0; m < nMax.n_elem; m++) {
+            const double dm(static_cast<double>(m));
+            const double l0(normalised ? std::exp(-0.5 * std::lgamma(dm + 1.)) : 1.);
+            const double l1(normalised ? l0 / std::sqrt(dm + 1.) : 1.);
+            double *lm = l + laguerreOffsets(m) * len;
+            if (nMax(m) > 0) {
+#pragma omp simd
+                for (arma::uword k = first; k < last; k++) {
+                    lm[k] = l0;
+                }
+            }
+            if (nMax(m) > 1) {
+#pragma omp simd
+                for (arma::uword k = first; k < last; k++) {
+                    lm[len + k] = l1 * (1. + dm - x[k]);
+                }
+            }
+            for (arma::sword depth = 2; depth < nMax(m); depth++) {
+                double *ln = lm + depth * len;
+                const double *ln1 = ln - len;
+                const double *ln2 = ln1 - len;
+                double alpha, scale, gamma;
+                laguerreCoefficients(static_cast<int>(m), static_cast<int>(depth), normalised, alpha, scale, gamma);
+#pragma omp simd
+                for (arma::uword k = first; k < last; k++) {
+                    ln[k] = (alpha - scale * x[k]) * ln1[k] - gamma * ln2[k];
+                }
+            }
+        }
+    }
 }
 
-void Poly::calcLaguerre(int mMax, int nMax, const arma::vec &z) {
+arma::vec Poly::hermiteSum(const arma::vec &coefs, const arma::vec &vec, bool normalised) {
+    const int nMax(static_cast<int>(coefs.n_elem) - 1);
+    arma::vec out(vec.n_elem, arma::fill::zeros);
+    if (nMax < 0) {
+        return out;
+    }
+
     /*
-     * Initialize the cube and helper vectors. Initialize also the first two slices (if needed) for the recursion
+     * b_n = c_n + a_{n+1} x b_{n+1} - c_{n+2} b_{n+2}, b_{nMax+1} = b_{nMax+2} = 0
+     * and the sum is H_0 b_0 = b_0
      */
-    laguerrePolynomial = arma::cube(mMax, z.n_elem, nMax, arma::fill::ones);
-    const arma::vec m = arma::regspace(0, mMax-1).as_col();
-    const arma::rowvec row_ones = arma::vec(z.n_elem, arma::fill::ones).as_row();
-    const arma::colvec col_ones = arma::vec(mMax, arma::fill::ones).as_col();
-    if (nMax>1) {
-        laguerrePolynomial.slice(1) = 1+(m*row_ones)-col_ones*z.as_row();
+    std::vector<double> a(nMax + 3, 0.), c(nMax + 3, 0.);
+    for (int i = 1; i <= nMax; i++) {
+        hermiteCoefficients(i, normalised, a[i], c[i]);
+    }
+
+    const double *x = vec.memptr();
+    double *s = out.memptr();
+#pragma omp parallel for if(parallelBlocks((vec.n_elem + POLY_BLOCK_SIZE - 1) / POLY_BLOCK_SIZE))
+    for (arma::uword k = 0; k < vec.n_elem; k++) {
+        double b1(0.), b2(0.);
+        for (int n = nMax; n >= 0; n--) {
+            const double b(coefs(n) + a[n + 1] * x[k] * b1 - c[n + 2] * b2);
+            b2 = b1;
+            b1 = b;
+        }
+        s[k] = b1;
+    }
+    return out;
+}
+
+arma::vec Poly::laguerreSum(int m, const arma::vec &coefs, const arma::vec &z, bool normalised) {
+    const int nMax(static_cast<int>(coefs.n_elem) - 1);
+    arma::vec out(z.n_elem, arma::fill::zeros);
+    if (nMax < 0) {
+        return out;
     }
 
     /*
-     * Now we build our cube, each slice is a matrix and within such slice N is constant, so we
-     * will operate on slices, its faster.
-     * The slice 0 is already filled with ones
+     * b_n = c_n + (alpha_{n+1} - s_{n+1} z) b_{n+1} - gamma_{n+2} b_{n+2}, b_{nMax+1} = b_{nMax+2} = 0
+     * and the sum is L_0 b_0
      */
-    for (int depth = 2; depth<nMax; depth++) {
-        arma::mat coef1(2+(m*row_ones-col_ones*z.as_row()-1)/static_cast<double> (depth));
-        arma::mat coef2(1+(m-1)/static_cast<double> (depth)*row_ones);
-        laguerrePolynomial.slice(depth) = coef1%laguerrePolynomial.slice(depth-1)-coef2%laguerrePolynomial.slice(depth-2);
+    std::vector<double> alpha(nMax + 3, 0.), scale(nMax + 3, 0.), gamma(nMax + 3, 0.);
+    for (int n = 1; n <= nMax; n++) {
+        laguerreCoefficients(m, n, normalised, alpha[n], scale[n], gamma[n]);
+    }
+    const double l0(normalised ? std::exp(-0.5 * std::lgamma(m + 1.)) : 1.);
+
+    const double *x = z.memptr();
+    double *s = out.memptr();
+#pragma omp parallel for if(parallelBlocks((z.n_elem + POLY_BLOCK_SIZE - 1) / POLY_BLOCK_SIZE))
+    for (arma::uword k = 0; k < z.n_elem; k++) {
+        double b1(0.), b2(0.);
+        for (int n = nMax; n >= 0; n--) {
+            const double b(coefs(n) + (alpha[n + 1] - scale[n + 1] * x[k]) * b1 - gamma[n + 2] * b2);
+            b2 = b1;
+            b1 = b;
+        }
+        s[k] = l0 * b1;
     }
+    return out;
 }
@@ -21,23 +21,62 @@
 #include <armadillo>
 #include <vector>
 
+#include "constants.h"
+
 /**
  * @class Poly
  * Used to compute Hermite and Laguerre polynomials
+ *
+ * Both can also be computed normalised, with the scaled three terms recurrences, which
+ * avoids the factorial growth of the raw polynomials:
+ * \f$ \tilde{H}_n = H_n / \sqrt{2^n n!} \f$ and \f$ \tilde{L}^m_n = \sqrt{n! / (n+m)!} L^m_n \f$.
  */
 class Poly {
 private:
-  /** matrix of hermite polynomials (n,z) */
+  /** matrix of hermite polynomials (z,n), each degree is a contiguous column */
   arma::mat hermitePolynomial;
-  /** cube of laguerre polynomials (m,n,z)*/
-  arma::cube laguerrePolynomial;
+  /** laguerre polynomials (z, (m,n)), only the pairs n < nMax(m) are stored, ordered by m then n */
+  arma::mat laguerrePolynomial;
+  /** column of the polynomial (m, 0) in laguerrePolynomial, with one extra element for the end */
+  arma::uvec laguerreOffsets;
+
+  /**
+   * @brief Coefficients of the Hermite recurrence \f$ H_i = a x H_{i-1} - c H_{i-2} \f$
+   * @param i degree of the polynomial computed by the recurrence step, i >= 1
+   * @param normalised if true, gives the coefficients of the normalised recurrence
+   * @param a set to the coefficient of \f$ x H_{i-1} \f$
+   * @param c set to the coefficient of \f$ H_{i-2} \f$ (0 for i = 1)
+   */
+  static void hermiteCoefficients(int i, bool normalised, double &a, double &c);
+
+  /**
+   * @brief Coefficients of the Laguerre recurrence \f$ L_n = (\alpha - s z) L_{n-1} - \gamma L_{n-2} \f$
+   * @param m the m parameter of the polynomials
+   * @param n degree of the polynomial computed by the recurrence step, n >= 1
+   * @param normalised if true, gives the coefficients of the normalised recurrence
+   * @param alpha set to \f$ \alpha \f$
+   * @param scale set to \f$ s \f$
+   * @param gamma set to \f$ \gamma \f$ (unused for n = 1)
+   */
+  static void laguerreCoefficients(int m, int n, bool normalised, double &alpha, double &scale, double &gamma);
+
+  /**
+   * @brief Tells if a loop over blocks of points is worth a team of threads
+   * @param blocks number of blocks of POLY_BLOCK_SIZE points
+   * @return true if every thread gets at least POLY_PARALLEL_BLOCKS blocks and the caller is not
+   * already in a parallel region
+   */
+  static bool parallelBlocks(arma::uword blocks);
 public:
   /**
    * @brief Iteratively evaluate the Hermite polynomial on a vector
+   * The points are processed by blocks of POLY_BLOCK_SIZE, all the degrees of a block
+   * are computed while it is in cache.
    * @param nMax max degree to compute
    * @param vec input vector
+   * @param normalised if true, computes \f$ H_n / \sqrt{2^n n!} \f$ instead of \f$ H_n \f$
    */
-  void calcHermite(uint nMax, const arma::vec &vec);
+  void calcHermite(uint nMax, const arma::vec &vec, bool normalised = false);
 
     /**
      * @brief Get the Hermite polynomial previously computed of rank n-1
@@ -45,13 +84,32 @@ public:
      */
     arma::vec hermite(int n)const ;
 
+    /**
+     * @brief Writes the Hermite polynomial previously computed of rank n into a caller buffer
+     * @param n the rank of the polynomial to get
+     * @param out buffer with room for one value per point of the input vector
+     */
+    void hermite(int n, double *out) const;
+
     /**
     * @brief Iteratively evaluate the Laguerre polynomial on a vector
     * @param mMax max m parameter
     * @param nMax max n parameter
     * @param z input vector
+    * @param normalised if true, computes \f$ \sqrt{n! / (n+m)!} L^m_n \f$ instead of \f$ L^m_n \f$
     */
-    void calcLaguerre(int mMax, int nMax, const arma::vec &z);
+    void calcLaguerre(int mMax, int nMax, const arma::vec &z, bool normalised = false);
+
+    /**
+    * @brief Iteratively evaluate the Laguerre polynomials needed by a basis, where the number
+    * of n values depends on m.
+    * The points are processed by blocks of POLY_BLOCK_SIZE and all the polynomials of a block
+    * are computed while it is in cache.
+    * @param nMax for each m, the number of n parameters to compute
+    * @param z input vector
+    * @param normalised if true, computes \f$ \sqrt{n! / (n+m)!} L^m_n \f$ instead of \f$ L^m_n \f$
+    */
+    void calcLaguerre(const arma::ivec &nMax, const arma::vec &z, bool normalised = false);
 
     /**
      * @brief Get the Laguerre polynomial previously computed with parameters m and n
@@ -59,6 +117,35 @@ public:
      * @param n the n parameter of the polynomial to get
      */
     arma::vec laguerre(int m, int n)const;
+
+    /**
+     * @brief Writes the Laguerre polynomial previously computed with parameters m and n into a caller buffer
+     * @param m the m parameter of the polynomial to get
+     * @param n the n parameter of the polynomial to get
+     * @param out buffer with room for one value per point of the input vector
+     */
+    void laguerre(int m, int n, double *out) const;
+
+    /**
+     * @brief Evaluates \f$ \sum_n c_n H_n(x) \f$ with the Clenshaw recurrence
+     * The polynomials are never stored: each point runs the recurrence backward on
+     * three scalars, so the memory used does not depend on the number of coefficients.
+     * @param coefs coefficients \f$ c_n \f$, from degree 0
+     * @param vec input vector
+     * @param normalised if true, sums the normalised polynomials
+     * @return the sum at each point of vec
+     */
+    static arma::vec hermiteSum(const arma::vec &coefs, const arma::vec &vec, bool normalised = false);
+
+    /**
+     * @brief Evaluates \f$ \sum_n c_n L^m_n(z) \f$ for a fixed m with the Clenshaw recurrence
+     * @param m the m parameter of the polynomials
+     * @param coefs coefficients \f$ c_n \f$, from n = 0
+     * @param z input vector
+     * @param normalised if true, sums the normalised polynomials
+     * @return the sum at each point of z
+     */
+    static arma::vec laguerreSum(int m, const arma::vec &coefs, const arma::vec &z, bool normalised = false);
 };
 
 #endif // POLY_H!
@@ -0,0 +1,127 @@
+#include <stdexcept>
+#include <string>
+
+#include "RhoBlocks.h"
+#include "RhoFile.h"
+
+/**
+ * The blocks are taken in the order of the file: first m, then n, then n_z.
+ * They are only packed once all of them passed the symmetry check.
+ */
+RhoBlocks::RhoBlocks(const arma::mat& rho, const Basis& basis, double tolerance)
+{
+    set_layout(basis);
+    arma::uword first = 0;
+    symmetric = true;
+    parity = true;
+    for (int m = 0; m<size(); m++) {
+        const arma::uword dim_m(dim(m));
+        const arma::ivec& nz_index(nz_indices[m]);
+        blocks.emplace_back(rho.submat(first, first, arma::size(dim_m, dim_m)));
+        symmetric = symmetric && arma::approx_equal(blocks.back(), blocks.back().t(), "absdiff", tolerance);
+        for (arma::uword j = 0; j<dim_m && parity; j++) {
+            for (arma::uword i = 0; i<dim_m && parity; i++) {
+                parity = (nz_index(i)+nz_index(j))%2==0 || std::abs(blocks.back().at(i, j))<=tolerance;
+            }
+        }
+        first += dim_m;
+    }
+
+    if (parity) {
+        for (int m = 0; m<size(); m++) {
+            for (arma::uword j = 0; j<dim(m); j++) {
+                for (arma::uword i = 0; i<dim(m); i++) {
+                    if ((nz_indices[m](i)+nz_indices[m](j))%2!=0) {
+                        blocks[m].at(i, j) = 0.0;
+                    }
+                }
+            }
+        }
+    }
+
+    if (symmetric) {
+        for (const arma::mat& b : blocks) {
+            arma::vec triangle(b.n_rows*(b.n_rows+1)/2);
+            for (arma::uword j = 0; j<b.n_cols; j++) {
+                for (arma::uword i = 0; i<=j; i++) {
+                    triangle(packed_index(i, j)) = 0.5*(b.at(i, j)+b.at(j, i));
+                }
+            }
+            packed.push_back(triangle);
+        }
+        blocks.clear();
+        unpack();
+    }
+}
+
+/**
+ * The blocks are wrapped where they are in the file, the file stays mapped as long as they are used.
+ * Packed symmetric blocks are only triangles, they are unpacked once into dense copies for block().
+ */
+RhoBlocks::RhoBlocks(const std::shared_ptr<const RhoFile>& file, const Basis& basis)
+{
+    set_layout(basis);
+    if (file->blocks()!=size()) {
+        throw std::invalid_argument("the rho file has "+std::to_string(file->blocks())+" m blocks, the basis "+std::to_string(size()));
+    }
+    symmetric = file->packed();
+    parity = file->conserves_parity();
+    /* reserved so that the vectors are never moved, which would copy their memory */
+    packed.reserve(size());
+    blocks.reserve(size());
+    for (int m = 0; m<size(); m++) {
+        if (file->dim(m)!=dim(m)) {
+            throw std::invalid_argument("the block "+std::to_string(m)+" of the rho file does not match the basis");
+        }
+        double* data(const_cast<double*>(file->block_data(m)));
+        if (symmetric) {
+            packed.emplace_back(data, dim(m)*(dim(m)+1)/2, false, true);
+        }
+        else {
+            blocks.emplace_back(data, dim(m), dim(m), false, true);
+        }
+    }
+    storage = file;
+    if (symmetric) {
+        unpack();
+    }
+}
+
+void RhoBlocks::set_layout(const Basis& basis)
+{
+    for (int m = 0; m<basis.mMax; m++) {
+        arma::uvec offset(basis.nMax(m));
+        arma::uword dim = 0;
+        for (int n = 0; n<basis.nMax(m); n++) {
+            offset(n) = dim;
+            dim += basis.n_zMax(m, n);
+        }
+
+        arma::ivec n_index(dim);
+        arma::ivec nz_index(dim);
+        for (int n = 0; n<basis.nMax(m); n++) {
+            for (int n_z = 0; n_z<basis.n_zMax(m, n); n_z++) {
+                n_index(offset(n)+n_z) = n;
+                nz_index(offset(n)+n_z) = n_z;
+            }
+        }
+        offsets.push_back(offset);
+        n_indices.push_back(n_index);
+        nz_indices.push_back(nz_index);
+    }
+}
+
+void RhoBlocks::unpack()
+{
+    unpacked.clear();
+    for (int m = 0; m<size(); m++) {
+        const arma::uword d(dim(m));
+        arma::mat full(d, d);
+        for (arma::uword j = 0; j<d; j++) {
+            for (arma::uword i = 0; i<=j; i++) {
+                full.at(i, j) = full.at(j, i) = packed[m].at(packed_index(i, j));
+            }
+        }
+        unpacked.push_back(full);
+    }
+}
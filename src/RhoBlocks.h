@@ -0,0 +1,162 @@
+/**
+ * @file RhoBlocks.h
+ */
+
+#ifndef PROJET_IPS1_RHOBLOCKS_H
+#define PROJET_IPS1_RHOBLOCKS_H
+
+#include <armadillo>
+#include <vector>
+#include <memory>
+
+#include "Basis.h"
+#include "constants.h"
+
+class RhoFile;
+
+/**
+ * @class RhoBlocks
+ * Block diagonal storage of the density matrix.
+ *
+ * Only the terms with m_a == m_b contribute to the density, so rho is stored as
+ * one contiguous matrix per m and everything outside those blocks is dropped.
+ * Inside a block the states are ordered by n then n_z, like in the file provided by the teacher,
+ * so the states (n, 0) ... (n, n_zMax(m, n) - 1) are contiguous.
+ *
+ * If rho is symmetric, only the upper triangle of each block is kept, in packed
+ * column major order: the element (i, j) with i <= j is at j * (j + 1) / 2 + i.
+ *
+ * If rho conserves parity (reflection symmetric nuclei), the states with n_za + n_zb odd
+ * are not coupled and the corresponding elements are set to exactly 0.
+ */
+class RhoBlocks {
+public:
+    RhoBlocks() = default;
+
+    /**
+     * Extracts the diagonal blocks of the full rho matrix and checks if they are symmetric
+     * @param rho full density matrix, its rows and columns are ordered by m, n, n_z
+     * @param basis basis in which rho is written, gives the size of each block
+     * @param tolerance largest |rho(a, b) - rho(b, a)| for which rho is considered symmetric,
+     * and largest |rho(a, b)| with n_za + n_zb odd for which rho is considered to conserve parity
+     */
+    RhoBlocks(const arma::mat& rho, const Basis& basis, double tolerance = RHO_SYMMETRY_TOLERANCE);
+
+    /**
+     * Uses the blocks of a mapped binary rho file in place, packed symmetric blocks being unpacked once here
+     * @param file mapped file, kept alive by the blocks
+     * @param basis basis in which rho is written
+     * @throw std::invalid_argument if the blocks of the file do not have the sizes given by the basis
+     */
+    RhoBlocks(const std::shared_ptr<const RhoFile>& file, const Basis& basis);
+
+    /**
+     * @return the number of m blocks
+     */
+    inline int size() const { return static_cast<int>(offsets.size()); }
+
+    /**
+     * @return true if rho passed the symmetry check at load time and is stored packed
+     */
+    inline bool is_symmetric() const { return symmetric; }
+
+    /**
+     * @return true if rho passed the parity check at load time, the density is then even in z
+     */
+    inline bool conserves_parity() const { return parity; }
+
+    /**
+     * @param m quantum number
+     * @return the number of states in the block m
+     */
+    inline arma::uword dim(int m) const { return n_indices[m].n_elem; }
+
+    /**
+     * @param m quantum number
+     * @return the dense block of rho for the quantum number m, unpacked once at load time if is_symmetric
+     */
+    inline const arma::mat& block(int m) const { return symmetric ? unpacked[m] : blocks[m]; }
+
+    /**
+     * @param m quantum number
+     * @param n quantum number
+     * @return the position of the state (n, n_z = 0) inside the block m
+     */
+    inline arma::uword offset(int m, int n) const { return offsets[m].at(n); }
+
+    /**
+     * @param m quantum number
+     * @return the quantum number n of each row of the block m
+     */
+    inline const arma::ivec& n_index(int m) const { return n_indices[m]; }
+
+    /**
+     * @param m quantum number
+     * @return the quantum number n_z of each row of the block m
+     */
+    inline const arma::ivec& nz_index(int m) const { return nz_indices[m]; }
+
+    /**
+     * @param m quantum number
+     * @param i row inside the block m
+     * @param j column inside the block m
+     * @return the element (i, j) of the block m
+     */
+    inline double at(int m, arma::uword i, arma::uword j) const
+    {
+        if (symmetric) {
+            return i<=j ? packed[m].at(packed_index(i, j)) : packed[m].at(packed_index(j, i));
+        }
+        return blocks[m].at(i, j);
+    }
+
+    /**
+     * @return rho(m, n, n_z, m, np, n_zp)
+     */
+    inline double operator()(int m, int n, int n_z, int np, int n_zp) const
+    {
+        return at(m, offsets[m].at(n)+n_z, offsets[m].at(np)+n_zp);
+    }
+
+    /**
+     * @param m quantum number
+     * @return the stored values of the block m, the packed upper triangle if is_symmetric,
+     * else the full block in column major order
+     */
+    inline const double* stored_memptr(int m) const { return symmetric ? packed[m].memptr() : blocks[m].memptr(); }
+
+    /**
+     * @param m quantum number
+     * @return the number of values stored for the block m
+     */
+    inline arma::uword n_stored(int m) const { return symmetric ? packed[m].n_elem : blocks[m].n_elem; }
+
+    /**
+     * @return the position of (i, j), i <= j, in a packed upper triangle
+     */
+    static inline arma::uword packed_index(arma::uword i, arma::uword j) { return j*(j+1)/2+i; }
+
+private:
+    /**
+     * Computes the position of the states of each block from the basis
+     * @param basis basis in which rho is written
+     */
+    void set_layout(const Basis& basis);
+
+    /**
+     * Fills unpacked from the packed triangles, for the callers doing matrix products
+     */
+    void unpack();
+
+    bool symmetric = false; /**< set at load time if every block is symmetric */
+    bool parity = false; /**< set at load time if no state of odd n_za + n_zb is coupled */
+    std::vector<arma::mat> blocks; /**< one square matrix per m, empty if symmetric */
+    std::vector<arma::vec> packed; /**< packed upper triangle of each block, empty if not symmetric */
+    std::vector<arma::mat> unpacked; /**< dense copy of each packed block, empty if not symmetric */
+    std::vector<arma::uvec> offsets; /**< position of (n, 0) in each block */
+    std::vector<arma::ivec> n_indices; /**< n of each row of each block */
+    std::vector<arma::ivec> nz_indices; /**< n_z of each row of each block */
+    std::shared_ptr<const void> storage; /**< owner of the memory of the blocks when they are not copied */
+};
+
+#endif //PROJET_IPS1_RHOBLOCKS_H
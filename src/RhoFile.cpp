@@ -0,0 +1,189 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "RhoFile.h"
+
+static_assert(sizeof(RhoFileHeader)==128, "the header of a rho file must be 128 bytes");
+static_assert(sizeof(RhoFileBlock)==16, "an entry of the table of blocks must be 16 bytes");
+
+static const char rho_file_magic[8] = {'I', 'P', 'S', 'R', 'H', 'O', '\0', '\0'};
+
+/**
+ * @param position a position in the file
+ * @return the first position after it aligned to RHO_FILE_ALIGNMENT
+ */
+static inline uint64_t aligned(uint64_t position)
+{
+    return (position+RHO_FILE_ALIGNMENT-1)/RHO_FILE_ALIGNMENT*RHO_FILE_ALIGNMENT;
+}
+
+/**
+ * @param dim number of states of a block
+ * @param packed true if the block is stored as a packed upper triangle
+ * @return the number of doubles stored for the block
+ */
+static inline uint64_t stored_values(uint64_t dim, bool packed)
+{
+    return packed ? dim*(dim+1)/2 : dim*dim;
+}
+
+const uint64_t RhoFile::fnv1a_offset_basis;
+
+/**
+ * Every size and position of the header and of the table of blocks is checked against the size
+ * of the file before any block is read, so a truncated or foreign file is rejected with a message.
+ */
+RhoFile::RhoFile(const std::string& path, bool verify)
+{
+    const int fd(open(path.c_str(), O_RDONLY));
+    if (fd<0) {
+        throw std::runtime_error("cannot open the rho file "+path);
+    }
+    struct stat info{};
+    if (fstat(fd, &info)!=0 || static_cast<size_t>(info.st_size)<sizeof(RhoFileHeader)) {
+        close(fd);
+        throw std::runtime_error(path+" is too small to be a rho file");
+    }
+    map_size = info.st_size;
+    map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); /* the mapping keeps its own reference to the file */
+    if (map==MAP_FAILED) {
+        map = nullptr;
+        throw std::runtime_error("cannot map the rho file "+path);
+    }
+    head = static_cast<const RhoFileHeader*>(map);
+    table = reinterpret_cast<const RhoFileBlock*>(head+1);
+
+    std::string problem;
+    if (std::memcmp(head->magic, rho_file_magic, sizeof(rho_file_magic))!=0) {
+        problem = "is not a rho file";
+    }
+    else if (head->version!=version) {
+        problem = "has version "+std::to_string(head->version)+" instead of "+std::to_string(version);
+    }
+    else if (head->byte_order!=byte_order_mark) {
+        problem = "was written with another byte order";
+    }
+    else if (head->ordering!=ordering_n_nz) {
+        problem = "has an unknown ordering of the states";
+    }
+    else if (head->blocks<0 || head->data_offset%RHO_FILE_ALIGNMENT!=0
+            || head->data_offset<sizeof(RhoFileHeader)+head->blocks*sizeof(RhoFileBlock)
+            || head->data_offset>map_size || head->data_size!=map_size-head->data_offset) {
+        problem = "is truncated or has an invalid header";
+    }
+    for (int m = 0; m<blocks() && problem.empty(); m++) {
+        const uint64_t end(table[m].offset+stored_values(table[m].dim, packed())*sizeof(double));
+        if (table[m].offset%RHO_FILE_ALIGNMENT!=0 || table[m].offset<head->data_offset || end>map_size) {
+            problem = "has an invalid block "+std::to_string(m);
+        }
+    }
+    if (problem.empty() && verify
+            && fnv1a(static_cast<const unsigned char*>(map)+sizeof(RhoFileHeader), map_size-sizeof(RhoFileHeader), header_hash(*head))
+               !=head->checksum) {
+        problem = "does not match its checksum";
+    }
+    if (!problem.empty()) {
+        munmap(map, map_size);
+        map = nullptr;
+        throw std::runtime_error("the rho file "+path+" "+problem);
+    }
+}
+
+bool RhoFile::is_rho_file(const std::string& path)
+{
+    char magic[sizeof(rho_file_magic)] = {};
+    std::ifstream in(path, std::ios::binary);
+    in.read(magic, sizeof(magic));
+    return in && std::memcmp(magic, rho_file_magic, sizeof(rho_file_magic))==0;
+}
+
+bool RhoFile::matches(int N, double Q, double br, double bz) const
+{
+    return head->N==N && head->Q==Q && head->br==br && head->bz==bz;
+}
+
+RhoFile::~RhoFile()
+{
+    if (map) {
+        munmap(map, map_size);
+    }
+}
+
+void RhoFile::write(const std::string& path, const RhoBlocks& rho, int N, double Q, double br, double bz)
+{
+    RhoFileHeader header{};
+    std::memcpy(header.magic, rho_file_magic, sizeof(rho_file_magic));
+    header.version = version;
+    header.byte_order = byte_order_mark;
+    header.N = N;
+    header.blocks = rho.size();
+    header.Q = Q;
+    header.br = br;
+    header.bz = bz;
+    header.ordering = ordering_n_nz;
+    if (rho.is_symmetric()) {
+        header.flags |= flag_packed;
+    }
+    if (rho.conserves_parity()) {
+        header.flags |= flag_parity;
+    }
+
+    std::vector<RhoFileBlock> blocks(rho.size());
+    header.data_offset = aligned(sizeof(RhoFileHeader)+blocks.size()*sizeof(RhoFileBlock));
+    uint64_t position(header.data_offset);
+    for (int m = 0; m<rho.size(); m++) {
+        blocks[m].offset = position;
+        blocks[m].dim = rho.dim(m);
+        position = aligned(position+rho.n_stored(m)*sizeof(double));
+    }
+    header.data_size = position-header.data_offset;
+
+    /* zeros between the blocks, so that the checksum does not depend on uninitialised memory */
+    std::vector<unsigned char> data(header.data_size, 0);
+    for (int m = 0; m<rho.size(); m++) {
+        std::memcpy(data.data()+(blocks[m].offset-header.data_offset), rho.stored_memptr(m), rho.n_stored(m)*sizeof(double));
+    }
+    /* the header, the table, the padding and the blocks in the order of the file */
+    const std::vector<char> padding(header.data_offset-sizeof(RhoFileHeader)-blocks.size()*sizeof(RhoFileBlock), 0);
+    uint64_t hash(header_hash(header));
+    hash = fnv1a(reinterpret_cast<const unsigned char*>(blocks.data()), blocks.size()*sizeof(RhoFileBlock), hash);
+    hash = fnv1a(reinterpret_cast<const unsigned char*>(padding.data()), padding.size(), hash);
+    header.checksum = fnv1a(data.data(), data.size(), hash);
+
+    /* The file is written next to the target and renamed over it, so a process that has the old
+     * file mapped keeps reading the old inode instead of seeing it change or shrink under it */
+    const std::string temporary(path+".tmp"+std::to_string(getpid()));
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(blocks.data()), blocks.size()*sizeof(RhoFileBlock));
+    out.write(padding.data(), padding.size());
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    out.close();
+    if (!out || std::rename(temporary.c_str(), path.c_str())!=0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("cannot write the rho file "+path);
+    }
+}
+
+uint64_t RhoFile::fnv1a(const unsigned char* data, size_t size, uint64_t hash)
+{
+    for (size_t i = 0; i<size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t RhoFile::header_hash(RhoFileHeader header)
+{
+    header.checksum = 0;
+    return fnv1a(reinterpret_cast<const unsigned char*>(&header), sizeof(header));
+}
@@ -0,0 +1,164 @@
+/**
+ * @file RhoFile.h
+ */
+
+#ifndef PROJET_IPS1_RHOFILE_H
+#define PROJET_IPS1_RHOFILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include "RhoBlocks.h"
+#include "constants.h"
+
+/**
+ * Fixed size header at the start of a binary rho file, in the byte order of the machine that wrote it
+ */
+struct RhoFileHeader {
+  char magic[8]; /**< "IPSRHO" followed by two null bytes */
+  uint32_t version; /**< version of the format, RhoFile::version */
+  uint32_t byte_order; /**< RhoFile::byte_order_mark as written by the machine */
+  int32_t N; /**< basis truncation parameter */
+  int32_t blocks; /**< number of m blocks */
+  double Q; /**< basis truncation parameter */
+  double br; /**< basis deformation along radius */
+  double bz; /**< basis deformation along z axis */
+  uint32_t ordering; /**< order of the states inside a block, RhoFile::ordering_n_nz */
+  uint32_t flags; /**< RhoFile::flag_packed and RhoFile::flag_parity */
+  uint64_t data_offset; /**< position of the first block, aligned to RHO_FILE_ALIGNMENT */
+  uint64_t data_size; /**< number of bytes from data_offset to the end of the file */
+  uint64_t checksum; /**< FNV-1a 64 bits hash of the whole file, this field being read as 0 */
+  char reserved[48]; /**< zeros, room for later versions */
+};
+
+/**
+ * Position and size of one m block, the table of blocks follows the header
+ */
+struct RhoFileBlock {
+  uint64_t offset; /**< position of the block in the file, aligned to RHO_FILE_ALIGNMENT */
+  uint64_t dim; /**< number of states of the block */
+};
+
+/**
+ * @class RhoFile
+ * Binary density matrix file, mapped read only in memory.
+ *
+ * The file holds the header, the table of blocks, then the stored values of each m block
+ * (see RhoBlocks::stored_memptr) as doubles, each block starting on a RHO_FILE_ALIGNMENT
+ * bytes boundary. Nothing has to be parsed to use it and the mapping is shared with the page cache,
+ * but packed symmetric blocks are unpacked by RhoBlocks into dense copies owned by each process.
+ */
+class RhoFile {
+public:
+    enum : uint32_t {
+        version = 2, /**< current version of the format, 1 only hashed the blocks */
+        byte_order_mark = 0x01020304, /**< read back as itself only with the same byte order */
+        ordering_n_nz = 0, /**< the states of a block are ordered by n, then n_z */
+        flag_packed = 1, /**< the blocks are packed upper triangles */
+        flag_parity = 2, /**< rho conserves parity, the odd couplings are null */
+    };
+
+    /**
+     * Maps the file and checks its header
+     * @param path path of the binary file
+     * @param verify if true, also checks the checksum of the header, the table of blocks and the
+     * blocks, which reads the whole file
+     * @throw std::runtime_error if the file can not be mapped or is not a valid rho file
+     */
+    explicit RhoFile(const std::string& path, bool verify = true);
+
+    RhoFile(const RhoFile&) = delete;
+
+    RhoFile& operator=(const RhoFile&) = delete;
+
+    /**
+     * Unmaps the file
+     */
+    ~RhoFile();
+
+    /**
+     * @return the header of the file
+     */
+    inline const RhoFileHeader& header() const { return *head; }
+
+    /**
+     * @return the number of m blocks
+     */
+    inline int blocks() const { return head->blocks; }
+
+    /**
+     * @return true if the blocks are stored as packed upper triangles
+     */
+    inline bool packed() const { return (head->flags & flag_packed)!=0; }
+
+    /**
+     * @return true if rho conserves parity
+     */
+    inline bool conserves_parity() const { return (head->flags & flag_parity)!=0; }
+
+    /**
+     * @param m quantum number
+     * @return the number of states of the block m
+     */
+    inline arma::uword dim(int m) const { return table[m].dim; }
+
+    /**
+     * @param m quantum number
+     * @return the stored values of the block m, in the mapped file
+     */
+    inline const double* block_data(int m) const
+    {
+        return reinterpret_cast<const double*>(static_cast<const char*>(map)+table[m].offset);
+    }
+
+    /**
+     * Only reads the magic number, to tell binary rho files from text ones
+     * @param path path of a file
+     * @return true if the file starts like a binary rho file
+     */
+    static bool is_rho_file(const std::string& path);
+
+    /**
+     * @return true if the file was written for exactly these basis parameters
+     */
+    bool matches(int N, double Q, double br, double bz) const;
+
+    /**
+     * Writes the blocks of rho in the binary format.
+     * An existing file is replaced by renaming a complete temporary file over it, never rewritten
+     * in place, so the processes that have it mapped keep a valid view of the previous version.
+     * @param path path of the file to write
+     * @param rho blocks of the density matrix
+     * @param N basis truncation parameter
+     * @param Q basis truncation parameter
+     * @param br basis deformation along radius
+     * @param bz basis deformation along z axis
+     * @throw std::runtime_error if the file can not be written
+     */
+    static void write(const std::string& path, const RhoBlocks& rho, int N, double Q, double br, double bz);
+
+    /**
+     * @param data bytes to hash
+     * @param size number of bytes
+     * @param hash hash of the bytes before data, to hash several buffers as one
+     * @return the 64 bits FNV-1a hash of the bytes
+     */
+    static uint64_t fnv1a(const unsigned char* data, size_t size, uint64_t hash = fnv1a_offset_basis);
+
+    static const uint64_t fnv1a_offset_basis = 14695981039346656037ULL; /**< FNV-1a hash of no bytes */
+
+private:
+    void* map = nullptr; /**< start of the mapping */
+    size_t map_size = 0; /**< size of the mapping, the size of the file */
+    const RhoFileHeader* head = nullptr; /**< header, at the start of the mapping */
+    const RhoFileBlock* table = nullptr; /**< table of blocks, after the header */
+
+    /**
+     * @param header header of the file, its checksum is hashed as 0
+     * @return the hash of the header, to be continued with the rest of the file
+     */
+    static uint64_t header_hash(RhoFileHeader header);
+};
+
+#endif //PROJET_IPS1_RHOFILE_H
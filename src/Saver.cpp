@@ -1,4 +1,5 @@
 #include "Saver.h"
+#include "Df3Writer.h"
 
 #include <utility>
 
@@ -12,31 +13,11 @@ void Saver::saveToCSV(const arma::mat& d, std::string filename)
 }
 
 /**
- *
+ * The voxels are |v| / max over the cube, 16 bits avoid the banding of the isosurfaces
  */
-void Saver::cubeToDf3(const arma::cube &m, const std::string& filename) {
-    std::stringstream ss(std::stringstream::out | std::stringstream::binary);
-    uint nx = m.n_rows;
-    uint ny = m.n_cols;
-    uint nz = m.n_slices;
-    ss.put(nx >> 8u);
-    ss.put(nx & 0xffu);
-    ss.put(ny >> 8u);
-    ss.put(ny & 0xffu);
-    ss.put(nz >> 8u);
-    ss.put(nz & 0xffu);
-    double theMin = 0.0;
-    double theMax = m.max();
-    for (uint k = 0; k < m.n_slices; k++) {
-        for (uint j = 0; j < m.n_cols; j++) {
-            for (uint i = 0; i < m.n_rows; i++) {
-                uint v = 255 * (fabs(m(i, j, k)) - theMin) / (theMax - theMin);
-                ss.put(v);
-            }
-        }
+void Saver::cubeToDf3(const arma::cube &m, const std::string& filename, int bits) {
+    const Df3Writer writer(filename, m.n_rows, m.n_cols, m.n_slices, m.max(), bits);
+    for (arma::uword k = 0; k < m.n_slices; k++) {
+        writer.write_slice(k, m.slice(k));
     }
-    std::ofstream file;
-    file.open(filename);
-    file << ss.str();
-    file.close();
-}
\ No newline at end of file
+}
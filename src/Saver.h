@@ -29,8 +29,9 @@ class Saver {
    *
    * @param m the cube to save to df3
    * @param filename the name of the df3 file (must end with .df3)
+   * @param bits size of a voxel, 8, 16 or 32
    */
-  static void cubeToDf3(const arma::cube &m, const std::string& filename);
+  static void cubeToDf3(const arma::cube &m, const std::string& filename, int bits = 8);
 };
 
 #endif // !SAVER_H
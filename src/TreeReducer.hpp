@@ -0,0 +1,139 @@
+/**
+ * @file TreeReducer.hpp
+ */
+
+
+#ifndef PROJET_IPS1_TREEREDUCER_HPP
+#define PROJET_IPS1_TREEREDUCER_HPP
+
+#include <cassert>
+#include <vector>
+#include <utility>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * @class TreeReducer
+ * Sum reduction with one private buffer per slot, usually one slot per thread.
+ *
+ * A slot is only written by the thread owning it, so adding to it needs no lock, and the
+ * buffers are merged at the end by a pairwise tree: slot i += slot i + s for s = 1, 2, 4...
+ * The pairs of a level are merged in parallel and the levels are separated by the barrier of
+ * the parallel loop, which is what orders the writes between threads.
+ * The merge order only depends on the number of slots, so if each slot receives the same
+ * values in the same order the result is bitwise reproducible.
+ * @tparam T value type, it needs a copy constructor and operator+=
+ */
+template<typename T>
+class TreeReducer {
+public:
+    /**
+     * Constructor to use
+     * @param identity the initial value of every buffer, like a zero matrix
+     * @param slots number of buffers, by default the maximum number of OpenMP threads
+     */
+    explicit TreeReducer(const T& identity, int slots = max_threads());
+
+    /**
+     * Buffer of the calling thread. The slot is the thread number, so this must be called from a
+     * parallel region of at most size() threads, which the default number of slots guarantees
+     * when the reducer is built right before the region, and not from a region nested in it,
+     * whose threads are numbered from 0 again. Both are checked by assertions.
+     * @return the buffer of the slot omp_get_thread_num()
+     */
+    inline T& local();
+
+    /**
+     * Buffer of a slot, which must not be used by two threads at the same time
+     * @param slot index of the slot
+     * @return the buffer of the slot
+     */
+    inline T& local(int slot);
+
+    /**
+     * Adds a value to the buffer of the calling thread, with the same requirements as local()
+     * @param arg
+     */
+    inline void push(const T& arg);
+
+    /**
+     * Merges the buffers with the pairwise tree. Must be called outside of the parallel
+     * region filling the buffers, which are consumed by the merge.
+     * @return the sum of all the buffers
+     */
+    T GetResult();
+
+    /**
+     * @return the number of slots
+     */
+    int size() const;
+
+    /**
+     * @return the number of threads of the next parallel region, 1 without OpenMP
+     */
+    static int max_threads();
+
+private:
+    std::vector<T> buffers; /**< One buffer per slot */
+};
+
+template<typename T>
+TreeReducer<T>::TreeReducer(const T& identity, const int slots)
+        : buffers(slots>0 ? slots : 1, identity) { }
+
+template<typename T>
+inline T& TreeReducer<T>::local()
+{
+#ifdef _OPENMP
+    assert(omp_get_level()<=1 && "TreeReducer::local called from a nested parallel region");
+    assert(omp_get_thread_num()<size() && "more threads than TreeReducer slots");
+    return buffers[omp_get_thread_num()];
+#else
+    return buffers[0];
+#endif
+}
+
+template<typename T>
+inline T& TreeReducer<T>::local(const int slot)
+{
+    return buffers[slot];
+}
+
+template<typename T>
+inline void TreeReducer<T>::push(const T& arg)
+{
+    local() += arg;
+}
+
+template<typename T>
+T TreeReducer<T>::GetResult()
+{
+    const int slots(buffers.size());
+    for (int stride = 1; stride<slots; stride *= 2) {
+#pragma omp parallel for default(shared)
+        for (int i = 0; i<slots-stride; i += 2*stride) {
+            buffers[i] += buffers[i+stride];
+        }
+    }
+    return std::move(buffers[0]);
+}
+
+template<typename T>
+int TreeReducer<T>::size() const
+{
+    return buffers.size();
+}
+
+template<typename T>
+int TreeReducer<T>::max_threads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+#endif //PROJET_IPS1_TREEREDUCER_HPP
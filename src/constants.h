@@ -11,5 +11,14 @@
 #define OMEGA 1.0 ///< Angular momentum
 #define STEP 0.01 ///< The step used in arma::regspace
 #define PI 3.141592653589793238462643383279502884 ///< Real value needed to normalize the scalar product else the kroneckers wont be equals to 1
+#define POLY_BLOCK_SIZE 128 ///< Number of points whose polynomials of all degrees are computed together, sized to stay in L1
+#define POLY_PARALLEL_BLOCKS 4 ///< Number of point blocks per thread below which the polynomials are computed by a single thread
+#define POINTS_CHUNK_SIZE 512 ///< Number of scattered points evaluated together by one thread
+#define DEFAULT_L2_CACHE_SIZE 262144 ///< L2 cache size in bytes assumed when the system does not report it
+#define DETERMINISTIC_CHUNKS 64 ///< Number of partial sums of the deterministic mode, whatever the number of threads
+#define RHO_FILE_ALIGNMENT 64 ///< Alignment in bytes of the blocks of a binary rho file, one cache line
+#define DF3_SLICES_PER_CHUNK 16 ///< Number of z slices of the density evaluated together when a df3 volume is streamed
+#define DF3_PARALLEL_VOXELS 65536 ///< Number of voxels of a df3 slice from which it is quantised by several threads
+#define RHO_SYMMETRY_TOLERANCE 1e-12 ///< Largest |rho(a, b) - rho(b, a)| for which rho is stored and summed as a symmetric matrix, and largest |rho(a, b)| with n_za + n_zb odd for which the coupling is treated as 0 and rho as conserving parity
 
 #endif
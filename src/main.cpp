@@ -19,9 +19,7 @@ int main()
 
     Saver::saveToCSV(res, "tmp/density-r-z.csv");
     
-    arma::cube cube = NuclearDensityCalculator::density_cartesian(xyPoints, zPoints, rVals, res);
-
-    Saver::cubeToDf3(cube, "tmp/density-r-z.df3");
+    nuclearDensityCalculator.density_cartesian_df3(rVals, rVals, zVals, "tmp/density-r-z.df3");
 
     return 0;
 }
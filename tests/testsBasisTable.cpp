@@ -0,0 +1,22 @@
+/**
+ * @file testsBasisTable.cpp
+ *
+ * This file contains unit test for the class BasisTable
+ */
+
+#include <gtest/gtest.h>
+#include <armadillo>
+
+#include "../src/Basis.h"
+#include "../src/BasisTable.h"
+
+TEST(BasisTable, SameAsBasis) {
+    Basis basis(1.935801664793151, 2.829683956491218, 14, 1.3);
+    arma::vec r = {3.1, 2.3, 1.0, 0.0, 0.1, 4.3, 9.2, 13.7};
+    arma::vec z = {-10.1, -8.4, -1.0, 0.0, 0.1, 4.3, 9.2, 13.7};
+    BasisTable table(1.935801664793151, 2.829683956491218, 14, 1.3, r, z);
+    ASSERT_NEAR(arma::norm(table.rPart(0, 0) - basis.rPart(r, 0, 0)), 0.0, 1e-15);
+    ASSERT_NEAR(arma::norm(table.rPart(8, 2) - basis.rPart(r, 8, 2)), 0.0, 1e-15);
+    ASSERT_NEAR(arma::norm(table.zPart(0) - basis.zPart(z, 0)), 0.0, 1e-15);
+    ASSERT_NEAR(arma::norm(table.zPart(15) - basis.zPart(z, 15)), 0.0, 1e-15);
+}
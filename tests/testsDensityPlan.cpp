@@ -0,0 +1,40 @@
+/**
+ * @file testsDensityPlan.cpp
+ *
+ * This file contains unit test for the class DensityPlan
+ */
+
+#include <gtest/gtest.h>
+#include <armadillo>
+
+#include "../src/Basis.h"
+#include "../src/RhoBlocks.h"
+#include "../src/DensityPlan.h"
+
+/**
+ * @brief The plan keeps each unordered pair of states of a block once, with rho counted twice off the diagonal
+ */
+TEST(DensityPlan, coefficients) {
+    Basis basis(1.935801664793151, 2.829683956491218, 14, 1.3);
+    arma::mat rho;
+    rho.load("src/rho.arma", arma::arma_ascii);
+    RhoBlocks blocks(rho, basis);
+    DensityPlan plan(basis, blocks);
+
+    arma::uword pairs = 0;
+    double total = 0.0;
+    for (int m = 0; m < blocks.size(); m++) {
+        pairs += blocks.dim(m) * (blocks.dim(m) + 1) / 2;
+        total += arma::accu(blocks.block(m));
+    }
+    ASSERT_EQ(plan.terms(), pairs);
+    double planned = 0.0;
+    for (arma::uword t = 0; t < plan.terms(); t++) {
+        planned += plan.coefficient(t);
+    }
+    ASSERT_NEAR(planned, total, 1e-12 * arma::accu(arma::abs(rho)));
+
+    // every term is reached from exactly one n_za group
+    ASSERT_EQ(plan.nzb_begin(0), 0u);
+    ASSERT_EQ(plan.b_end(plan.a_end(plan.nzb_end(plan.size() - 1) - 1) - 1), plan.terms());
+}
@@ -0,0 +1,73 @@
+/**
+ * @file testsDf3Writer.cpp
+ *
+ * This file contains unit test for the class Df3Writer and the df3 export of the class Saver
+ */
+
+#include <gtest/gtest.h>
+#include <armadillo>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../src/Df3Writer.h"
+#include "../src/Saver.h"
+#include "../src/constants.h"
+
+/**
+ * @brief The voxels are big endian integers of the requested size, the maximum being 2^bits - 1
+ */
+TEST(Df3Writer, bits) {
+    const std::string name("test-bits.df3");
+    const arma::cube cube(arma::vec{1.0, -0.5}.memptr(), 2, 1, 1);
+    const std::vector<std::string> expected{
+            std::string("\xff\x7f", 2),
+            std::string("\xff\xff\x7f\xff", 4),
+            std::string("\xff\xff\xff\xff\x7f\xff\xff\xff", 8)};
+    for (int i = 0; i < 3; i++) {
+        Saver::cubeToDf3(cube, name, 8 << i);
+        std::ifstream file(name, std::ios::binary);
+        const std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        ASSERT_EQ(bytes, std::string("\x00\x02\x00\x01\x00\x01", 6) + expected[i]);
+    }
+    std::remove(name.c_str());
+    ASSERT_THROW(Saver::cubeToDf3(cube, name, 12), std::invalid_argument);
+}
+
+/**
+ * @brief A slice given as a matrix must have the size of the volume
+ */
+TEST(Df3Writer, sliceShape) {
+    const std::string name("test-shape.df3");
+    const Df3Writer writer(name, 2, 3, 1, 1.0);
+    ASSERT_THROW(writer.write_slice(0, arma::mat(3, 2, arma::fill::ones)), std::invalid_argument);
+    ASSERT_THROW(writer.write_slice(0, arma::mat(2, 2, arma::fill::ones)), std::invalid_argument);
+    ASSERT_NO_THROW(writer.write_slice(0, arma::mat(2, 3, arma::fill::ones)));
+    std::remove(name.c_str());
+}
+
+/**
+ * @brief A slice of DF3_PARALLEL_VOXELS voxels or more is quantised by several threads, into the same bytes
+ */
+TEST(Df3Writer, largeSlice) {
+    const std::string name("test-large.df3");
+    const arma::uword n = 256;
+    ASSERT_GE(n * n, static_cast<arma::uword>(DF3_PARALLEL_VOXELS));
+    const arma::cube cube(arma::linspace(-1.0, 1.0, n * n * 2).memptr(), n, n, 2);
+    // same operations as the writer, so the voxels are exact
+    const double scale = 65535 / cube.max();
+    Saver::cubeToDf3(cube, name, 16);
+    std::ifstream file(name, std::ios::binary);
+    const std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::remove(name.c_str());
+    ASSERT_EQ(bytes.size(), 6 + cube.n_elem * 2);
+    for (arma::uword i = 0; i < cube.n_elem; i++) {
+        const unsigned voxel = static_cast<unsigned char>(bytes[6 + 2 * i]) * 256u
+                               + static_cast<unsigned char>(bytes[7 + 2 * i]);
+        ASSERT_EQ(voxel, static_cast<unsigned>(std::fabs(cube(i)) * scale)) << "voxel " << i;
+    }
+}
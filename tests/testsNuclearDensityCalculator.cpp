@@ -7,8 +7,18 @@
 #include <gtest/gtest.h>
 #include <armadillo>
 #include <vector>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
 
 #include "../src/NuclearDensityCalculator.h"
+#include "../src/Saver.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 double xyBound = 10;
@@ -64,6 +74,195 @@ TEST_F(NuclearDensityTest, optimized_method3) {
     ASSERT_NEAR(arma::norm(opti - *res), 0.0, 1e-08);
 }
 
+#ifdef _OPENMP
+TEST_F(NuclearDensityTest, deterministic) {
+    const int threads = omp_get_max_threads();
+    ndc->set_deterministic(true);
+    omp_set_num_threads(1);
+    arma::mat serial = ndc->optimized_method3(*rVals, *zVals);
+    omp_set_num_threads(std::max(threads, 4));
+    arma::mat parallel = ndc->optimized_method3(*rVals, *zVals);
+    omp_set_num_threads(threads);
+    ndc->set_deterministic(false);
+    ASSERT_NEAR(arma::norm(serial - *res), 0.0, 1e-08);
+    // same bits, not only the same values up to rounding
+    ASSERT_EQ(arma::accu(serial != parallel), 0u);
+}
+#endif
+
+TEST_F(NuclearDensityTest, gemm_method) {
+    arma::mat opti = ndc->gemm_method(*rVals, *zVals);
+    ASSERT_NEAR(arma::norm(opti - *res), 0.0, 1e-08);
+}
+
+TEST_F(NuclearDensityTest, tiled_method) {
+    arma::mat opti = ndc->tiled_method(*rVals, *zVals);
+    ASSERT_NEAR(arma::norm(opti - *res), 0.0, 1e-08);
+
+    // tiles that do not divide the grid, with and without the hoisted envelope
+    ndc->set_tile_size(7);
+    arma::mat small = ndc->tiled_method(*rVals, *zVals);
+    ndc->set_envelope_hoisting(true);
+    arma::mat hoisted = ndc->tiled_method(*rVals, *zVals);
+    ndc->set_envelope_hoisting(false);
+    ndc->set_tile_size(0);
+    ASSERT_NEAR(arma::norm(small - *res), 0.0, 1e-08);
+    ASSERT_NEAR(arma::norm(hoisted - *res), 0.0, 1e-08);
+}
+
+TEST_F(NuclearDensityTest, envelope_hoisting) {
+    ndc->set_envelope_hoisting(true);
+    arma::mat opti3 = ndc->optimized_method3(*rVals, *zVals);
+    arma::mat gemm = ndc->gemm_method(*rVals, *zVals);
+    arma::mat orbitals = ndc->natural_orbitals_method(*rVals, *zVals);
+    ndc->set_envelope_hoisting(false);
+    ASSERT_NEAR(arma::norm(opti3 - *res), 0.0, 1e-08);
+    ASSERT_NEAR(arma::norm(gemm - *res), 0.0, 1e-08);
+    ASSERT_NEAR(arma::norm(orbitals - *res), 0.0, 1e-08);
+}
+
+TEST_F(NuclearDensityTest, evaluate_points) {
+    // every point of the grid, in a scattered order
+    arma::mat rz(rVals->n_elem * zVals->n_elem, 2);
+    arma::vec expected(rz.n_rows);
+    arma::uword i = 0;
+    for (arma::uword z = 0; z < zVals->n_elem; z++) {
+        for (arma::uword r = 0; r < rVals->n_elem; r++) {
+            rz(i, 0) = (*rVals)(r);
+            rz(i, 1) = (*zVals)(z);
+            expected(i) = (*res)(r, z);
+            i++;
+        }
+    }
+    arma::uvec order = arma::shuffle(arma::regspace<arma::uvec>(0, rz.n_rows - 1));
+    arma::vec density = ndc->evaluate_points(rz.rows(order));
+    ASSERT_NEAR(arma::norm(density - expected.elem(order)), 0.0, 1e-08);
+}
+
+TEST_F(NuclearDensityTest, natural_orbitals_method) {
+    arma::mat opti = ndc->natural_orbitals_method(*rVals, *zVals);
+    ASSERT_NEAR(arma::norm(opti - *res), 0.0, 1e-08);
+    ASSERT_DOUBLE_EQ(ndc->truncation_error(0.0), 0.0);
+}
+
+TEST_F(NuclearDensityTest, natural_orbitals_truncation) {
+    double threshold = 1e-3;
+    arma::mat opti = ndc->natural_orbitals_method(*rVals, *zVals, threshold);
+    ASSERT_GT(ndc->truncation_error(threshold), 0.0);
+    ASSERT_LE(ndc->truncation_error(threshold), ndc->truncation_error(10 * threshold));
+    ASSERT_GT(arma::norm(opti - *res), 0.0);
+
+    // the bound is on the integral of |error| over the space, 2 pi r dr dz in cylindrical coordinates
+    arma::vec r = arma::linspace(0, xyBound, 201);
+    arma::vec z = arma::linspace(-zBound, zBound, 401);
+    arma::mat error = arma::abs(ndc->natural_orbitals_method(r, z, threshold) - ndc->gemm_method(r, z));
+    error.each_col() %= 2 * arma::datum::pi * r;
+    double integral = arma::as_scalar(arma::trapz(z, arma::trapz(r, error).t()));
+    ASSERT_GT(integral, 0.0);
+    ASSERT_LE(integral, ndc->truncation_error(threshold));
+}
+
+TEST_F(NuclearDensityTest, parity_folding) {
+    // rho without the couplings of odd n_za + n_zb, so that the z axis is folded too
+    Basis basis(1.935801664793151, 2.829683956491218, 14, 1.3);
+    std::vector<int> nz;
+    for (int m = 0; m < basis.mMax; m++) {
+        for (int n = 0; n < basis.nMax(m); n++) {
+            for (int n_z = 0; n_z < basis.n_zMax(m, n); n_z++) {
+                nz.push_back(n_z);
+            }
+        }
+    }
+    arma::mat rho;
+    rho.load("src/rho.arma", arma::arma_ascii);
+    for (arma::uword j = 0; j < rho.n_cols; j++) {
+        for (arma::uword i = 0; i < rho.n_rows; i++) {
+            if ((nz[i] + nz[j]) % 2 != 0) {
+                rho(i, j) = 0.0;
+            }
+        }
+    }
+    NuclearDensityCalculator even(1.935801664793151, 2.829683956491218, 14, 1.3, rho);
+    ASSERT_TRUE(even.shared_nucleus()->rho_blocks.conserves_parity());
+
+    // zVals is symmetric about 0, so every folded method only evaluates half of it
+    arma::mat expected = even.naive_method(*rVals, *zVals);
+    ASSERT_NEAR(arma::norm(even.optimized_method3(*rVals, *zVals) - expected), 0.0, 1e-08);
+    ASSERT_NEAR(arma::norm(even.gemm_method(*rVals, *zVals) - expected), 0.0, 1e-08);
+    ASSERT_NEAR(arma::norm(even.tiled_method(*rVals, *zVals) - expected), 0.0, 1e-08);
+    ASSERT_NEAR(arma::norm(even.natural_orbitals_method(*rVals, *zVals) - expected), 0.0, 1e-08);
+    // the result is even in z
+    ASSERT_NEAR(arma::norm(expected - arma::fliplr(expected)), 0.0, 1e-08);
+}
+
+TEST_F(NuclearDensityTest, rho_sources) {
+    arma::mat rho;
+    rho.load("src/rho.arma", arma::arma_ascii);
+    NuclearDensityCalculator fromMatrix(1.935801664793151, 2.829683956491218, 14, 1.3, rho);
+    ASSERT_NEAR(arma::norm(fromMatrix.gemm_method(*rVals, *zVals) - *res), 0.0, 1e-08);
+
+    NuclearDensityCalculator fromFile = NuclearDensityCalculator::from_file(1.935801664793151, 2.829683956491218, 14, 1.3, "src/rho.arma");
+    ASSERT_NEAR(arma::norm(fromFile.gemm_method(*rVals, *zVals) - *res), 0.0, 1e-08);
+
+    // the layout of the basis must match rho
+    ASSERT_THROW(NuclearDensityCalculator(1.935801664793151, 2.829683956491218, 12, 1.3, rho), std::invalid_argument);
+    ASSERT_THROW(NuclearDensityCalculator(1.935801664793151, 2.829683956491218, 14, 1.3, rho.head_rows(10)), std::invalid_argument);
+    ASSERT_THROW(NuclearDensityCalculator::from_file(1.935801664793151, 2.829683956491218, 14, 1.3, "missing.arma"), std::runtime_error);
+
+    // binary file, mapped by the caller or recognised by from_file
+    const std::string binary("test-sources.bin");
+    RhoFile::write(binary, ndc->shared_nucleus()->rho_blocks, 14, 1.3, 1.935801664793151, 2.829683956491218);
+    std::shared_ptr<const RhoFile> file = std::make_shared<const RhoFile>(binary);
+    NuclearDensityCalculator fromMapped(1.935801664793151, 2.829683956491218, 14, 1.3, file);
+    ASSERT_NEAR(arma::norm(fromMapped.gemm_method(*rVals, *zVals) - *res), 0.0, 1e-08);
+    NuclearDensityCalculator fromBinary = NuclearDensityCalculator::from_file(1.935801664793151, 2.829683956491218, 14, 1.3, binary);
+    ASSERT_NEAR(arma::norm(fromBinary.gemm_method(*rVals, *zVals) - *res), 0.0, 1e-08);
+
+    // the file was written for another basis
+    ASSERT_THROW(NuclearDensityCalculator(1.935801664793151, 2.829683956491218, 12, 1.3, file), std::invalid_argument);
+    ASSERT_THROW(NuclearDensityCalculator::from_file(1.935801664793151, 2.829683956491218, 12, 1.3, binary), std::invalid_argument);
+    std::remove(binary.c_str());
+}
+
+TEST_F(NuclearDensityTest, shared_nucleus) {
+    // same files and basis as the fixture: nothing is loaded again
+    size_t stored = NucleusStore::size();
+    NuclearDensityCalculator other;
+    ASSERT_EQ(other.shared_nucleus().get(), ndc->shared_nucleus().get());
+    ASSERT_EQ(NucleusStore::size(), stored);
+
+    arma::mat rho;
+    rho.load("src/rho.arma", arma::arma_ascii);
+    NuclearDensityCalculator first(1.935801664793151, 2.829683956491218, 14, 1.3, rho);
+    NuclearDensityCalculator second(1.935801664793151, 2.829683956491218, 14, 1.3, rho);
+    ASSERT_EQ(first.shared_nucleus().get(), second.shared_nucleus().get());
+
+    // another matrix is another nucleus
+    rho(0, 0) += 1e-3;
+    NuclearDensityCalculator changed(1.935801664793151, 2.829683956491218, 14, 1.3, rho);
+    ASSERT_NE(changed.shared_nucleus().get(), first.shared_nucleus().get());
+}
+
+TEST_F(NuclearDensityTest, store_drops_unused_nuclei) {
+    arma::mat rho;
+    rho.load("src/rho.arma", arma::arma_ascii);
+    rho(0, 0) += 2e-3;
+    size_t stored = NucleusStore::size();
+    std::weak_ptr<const Nucleus> nucleus;
+    {
+        NuclearDensityCalculator first(1.935801664793151, 2.829683956491218, 14, 1.3, rho);
+        NuclearDensityCalculator second(1.935801664793151, 2.829683956491218, 14, 1.3, rho);
+        ASSERT_EQ(first.shared_nucleus().get(), second.shared_nucleus().get());
+        ASSERT_EQ(NucleusStore::size(), stored + 1);
+        nucleus = first.shared_nucleus();
+    }
+    // freed with its last calculator, and built again when asked for
+    ASSERT_TRUE(nucleus.expired());
+    ASSERT_EQ(NucleusStore::size(), stored);
+    NuclearDensityCalculator again(1.935801664793151, 2.829683956491218, 14, 1.3, rho);
+    ASSERT_TRUE(again.shared_nucleus() != nullptr);
+    ASSERT_EQ(NucleusStore::size(), stored + 1);
+}
 
 /**
  * structure of points to test the density calculation
@@ -109,3 +308,76 @@ TEST_P(DensityPointTest, cartesianConversion) {
 INSTANTIATE_TEST_SUITE_P(PointsWithYZero, DensityPointTest, testing::Values(
     p1, p2, p3, p4
 ));
+
+/**
+ * @brief The direct cartesian evaluation gives the density at the exact radius of each (x, y)
+ */
+TEST_F(NuclearDensityTest, directCartesian) {
+    arma::cube cube = ndc->density_cartesian(*rVals, *rVals, *zVals);
+    ASSERT_EQ(cube.n_rows, rVals->n_elem);
+    ASSERT_EQ(cube.n_slices, zVals->n_elem);
+
+    arma::mat rz(0, 2);
+    arma::vec expected;
+    for (arma::uword x = 0; x < rVals->n_elem; x += 3) {
+        for (arma::uword y = 0; y < rVals->n_elem; y += 5) {
+            for (arma::uword z = 0; z < zVals->n_elem; z += 7) {
+                rz.insert_rows(rz.n_rows, arma::rowvec{std::hypot((*rVals)(x), (*rVals)(y)), (*zVals)(z)});
+                expected.insert_rows(expected.n_rows, arma::vec{cube(x, y, z)});
+            }
+        }
+    }
+    ASSERT_NEAR(arma::norm(ndc->evaluate_points(rz) - expected), 0.0, 1e-08);
+    // x <-> y symmetry
+    for (arma::uword z = 0; z < cube.n_slices; z++) {
+        ASSERT_NEAR(arma::abs(cube.slice(z) - cube.slice(z).t()).max(), 0.0, 1e-12);
+    }
+}
+
+/**
+ * @brief The df3 files have the header and the voxels 255 |v| / max of the density_cartesian volume,
+ * x varying fastest, whether they are streamed slice by slice or saved from the cube
+ */
+TEST_F(NuclearDensityTest, densityCartesianDf3) {
+    const std::string streamed("test-streamed.df3"), saved("test-saved.df3");
+    arma::cube cube = ndc->density_cartesian(*rVals, *rVals, *zVals);
+    ndc->density_cartesian_df3(*rVals, *rVals, *zVals, streamed);
+    Saver::cubeToDf3(cube, saved);
+
+    const double max = cube.max();
+    const arma::uword n = rVals->n_elem, nz = zVals->n_elem;
+    const std::string header{0, static_cast<char>(n), 0, static_cast<char>(n), 0, static_cast<char>(nz)};
+    for (const std::string& name : {streamed, saved}) {
+        std::ifstream file(name, std::ios::binary);
+        const std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::remove(name.c_str());
+        ASSERT_EQ(bytes.size(), 6 + n * n * nz);
+        ASSERT_EQ(bytes.substr(0, 6), header);
+        // the two evaluations may round differently, so a voxel can be one step away
+        for (arma::uword i = 0; i < cube.n_elem; i++) {
+            double expected = 255 * std::fabs(cube(i)) / max;
+            ASSERT_NEAR(static_cast<unsigned char>(bytes[6 + i]), expected, 1.0) << name << " voxel " << i;
+        }
+    }
+}
+
+/**
+ * @brief The streamed df3 export writes 16 bits voxels, big endian
+ */
+TEST_F(NuclearDensityTest, densityCartesianDf3Bits16) {
+    const std::string name("test-streamed16.df3");
+    arma::cube cube = ndc->density_cartesian(*rVals, *rVals, *zVals);
+    ndc->density_cartesian_df3(*rVals, *rVals, *zVals, name, 16);
+
+    const double max = cube.max();
+    const arma::uword n = rVals->n_elem, nz = zVals->n_elem;
+    std::ifstream file(name, std::ios::binary);
+    const std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::remove(name.c_str());
+    ASSERT_EQ(bytes.size(), 6 + n * n * nz * 2);
+    for (arma::uword i = 0; i < cube.n_elem; i++) {
+        const unsigned voxel = static_cast<unsigned char>(bytes[6 + 2 * i]) * 256u
+                               + static_cast<unsigned char>(bytes[7 + 2 * i]);
+        ASSERT_NEAR(voxel, 65535 * std::fabs(cube(i)) / max, 1.0) << "voxel " << i;
+    }
+}
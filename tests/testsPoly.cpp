@@ -0,0 +1,82 @@
+/**
+ * @file testsPoly.cpp
+ *
+ * This file contains unit test for the class Poly and the polynomial sums of the class Basis
+ */
+
+#include <gtest/gtest.h>
+#include <armadillo>
+#include <cmath>
+
+#include "../src/Poly.h"
+#include "../src/Basis.h"
+
+TEST(PolyClass, Normalised) {
+    Poly raw, normalised;
+    arma::vec zVals = {-3.1, -2.3, -1.0, -0.3, 0.1, 4.3, 9.2, 13.7};
+    raw.calcHermite(20, zVals);
+    normalised.calcHermite(20, zVals, true);
+    for (int n = 0; n <= 20; n++) {
+        double norm = std::sqrt(std::pow(2.0, n) * std::tgamma(n + 1.0));
+        ASSERT_LE(arma::norm(normalised.hermite(n) - raw.hermite(n) / norm), 1e-12 * arma::norm(raw.hermite(n) / norm));
+    }
+
+    zVals = {0.1, 0.3, 1.2, 1.8, 2.0, 2.5, 7.1, 11.1};
+    raw.calcLaguerre(6, 4, zVals);
+    normalised.calcLaguerre(6, 4, zVals, true);
+    for (int m = 0; m < 6; m++) {
+        for (int n = 0; n < 4; n++) {
+            double norm = std::sqrt(std::tgamma(n + 1.0) / std::tgamma(n + m + 1.0));
+            ASSERT_NEAR(arma::norm(normalised.laguerre(m, n) - norm * raw.laguerre(m, n)), 0.0, 1e-10);
+        }
+    }
+}
+
+TEST(PolyClass, ClenshawSums) {
+    arma::vec zVals = {-3.1, -2.3, -1.0, -0.3, 0.1, 4.3, 9.2, 13.7};
+    arma::vec coefs = {0.5, -1.2, 0.3, 2.0, -0.7, 0.1, 1.1};
+    Poly poly;
+    for (bool normalised : {false, true}) {
+        poly.calcHermite(coefs.n_elem - 1, zVals, normalised);
+        arma::vec expected(zVals.n_elem, arma::fill::zeros);
+        for (arma::uword n = 0; n < coefs.n_elem; n++) {
+            expected += coefs(n) * poly.hermite(n);
+        }
+        ASSERT_LE(arma::norm(Poly::hermiteSum(coefs, zVals, normalised) - expected), 1e-10 * arma::norm(expected));
+    }
+
+    zVals = {0.1, 0.3, 1.2, 1.8, 2.0, 2.5, 7.1, 11.1};
+    for (bool normalised : {false, true}) {
+        poly.calcLaguerre(4, coefs.n_elem, zVals, normalised);
+        for (int m = 0; m < 4; m++) {
+            arma::vec expected(zVals.n_elem, arma::fill::zeros);
+            for (arma::uword n = 0; n < coefs.n_elem; n++) {
+                expected += coefs(n) * poly.laguerre(m, n);
+            }
+            ASSERT_LE(arma::norm(Poly::laguerreSum(m, coefs, zVals, normalised) - expected), 1e-10 * arma::norm(expected));
+        }
+    }
+    ASSERT_EQ(arma::norm(Poly::hermiteSum(arma::vec(), zVals)), 0.0);
+}
+
+TEST(Basis, ClenshawSums) {
+    arma::vec rVals = arma::linspace(0.0, 10.0, 17);
+    arma::vec zVals = arma::linspace(-20.0, 20.0, 33);
+    Basis basis(1.935801664793151, 2.829683956491218, 14, 1.3);
+
+    arma::vec zCoefs = arma::linspace(1.0, -1.0, basis.n_zMax(0, 0));
+    arma::vec zExpected(zVals.n_elem, arma::fill::zeros);
+    for (arma::uword nz = 0; nz < zCoefs.n_elem; nz++) {
+        zExpected += zCoefs(nz) * basis.zPart(zVals, nz);
+    }
+    ASSERT_LE(arma::norm(basis.zSum(zVals, zCoefs) - zExpected), 1e-10 * arma::norm(zExpected));
+
+    for (int m = 0; m < basis.mMax; m += 3) {
+        arma::vec rCoefs = arma::linspace(-0.5, 1.5, basis.nMax(m));
+        arma::vec rExpected(rVals.n_elem, arma::fill::zeros);
+        for (arma::uword n = 0; n < rCoefs.n_elem; n++) {
+            rExpected += rCoefs(n) * basis.rPart(rVals, m, n);
+        }
+        ASSERT_LE(arma::norm(basis.rSum(rVals, m, rCoefs) - rExpected), 1e-10 * arma::norm(rExpected));
+    }
+}
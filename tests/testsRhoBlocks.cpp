@@ -0,0 +1,80 @@
+/**
+ * @file testsRhoBlocks.cpp
+ *
+ * This file contains unit test for the class RhoBlocks
+ */
+
+#include <gtest/gtest.h>
+#include <armadillo>
+
+#include "../src/RhoBlocks.h"
+
+/**
+ * @brief The blocks are the m_a == m_b diagonal blocks of the file, and rho is detected as symmetric
+ */
+TEST(RhoBlocks, blocksFromFile) {
+    Basis basis(1.935801664793151, 2.829683956491218, 14, 1.3);
+    arma::mat rho;
+    rho.load("src/rho.arma", arma::arma_ascii);
+    RhoBlocks blocks(rho, basis);
+
+    ASSERT_TRUE(blocks.is_symmetric());
+    ASSERT_EQ(blocks.size(), basis.mMax);
+    arma::uword first = 0;
+    for (int m = 0; m < blocks.size(); m++) {
+        arma::uword dim = blocks.dim(m);
+        ASSERT_TRUE(arma::approx_equal(blocks.block(m), rho.submat(first, first, arma::size(dim, dim)), "absdiff", 1e-15));
+        first += dim;
+    }
+    ASSERT_EQ(first, rho.n_rows);
+
+    // rho(m = 2, n = 1, n_z = 3, m = 2, n = 0, n_z = 4)
+    arma::uword block2 = blocks.dim(0) + blocks.dim(1);
+    ASSERT_DOUBLE_EQ(blocks(2, 1, 3, 0, 4), rho(block2 + blocks.offset(2, 1) + 3, block2 + 4));
+}
+
+/**
+ * @brief A non symmetric rho is kept as full blocks
+ */
+TEST(RhoBlocks, nonSymmetric) {
+    Basis basis(1.935801664793151, 2.829683956491218, 14, 1.3);
+    arma::mat rho;
+    rho.load("src/rho.arma", arma::arma_ascii);
+    rho(1, 0) += 1e-3;
+    RhoBlocks blocks(rho, basis);
+
+    ASSERT_FALSE(blocks.is_symmetric());
+    ASSERT_DOUBLE_EQ(blocks.at(0, 1, 0), rho(1, 0));
+    ASSERT_DOUBLE_EQ(blocks.at(0, 0, 1), rho(0, 1));
+}
+
+/**
+ * @brief Parity is detected when only states of the same z parity are coupled
+ */
+TEST(RhoBlocks, parity) {
+    Basis basis(1.935801664793151, 2.829683956491218, 14, 1.3);
+    arma::mat rho;
+    rho.load("src/rho.arma", arma::arma_ascii);
+    ASSERT_FALSE(RhoBlocks(rho, basis).conserves_parity());
+
+    // n_z of each state, in the order of the file
+    arma::ivec nz(rho.n_rows);
+    arma::uword i = 0;
+    for (int m = 0; m < basis.mMax; m++) {
+        for (int n = 0; n < basis.nMax(m); n++) {
+            for (int n_z = 0; n_z < basis.n_zMax(m, n); n_z++) {
+                nz(i++) = n_z;
+            }
+        }
+    }
+    for (arma::uword b = 0; b < rho.n_cols; b++) {
+        for (arma::uword a = 0; a < rho.n_rows; a++) {
+            if ((nz(a) + nz(b)) % 2 != 0) {
+                rho(a, b) = 0.0;
+            }
+        }
+    }
+    RhoBlocks blocks(rho, basis);
+    ASSERT_TRUE(blocks.conserves_parity());
+    ASSERT_TRUE(blocks.is_symmetric());
+}
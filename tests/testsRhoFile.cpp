@@ -0,0 +1,67 @@
+/**
+ * @file testsRhoFile.cpp
+ *
+ * This file contains unit test for the class RhoFile, the binary format of rho
+ */
+
+#include <gtest/gtest.h>
+#include <armadillo>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "../src/Basis.h"
+#include "../src/RhoBlocks.h"
+#include "../src/RhoFile.h"
+
+/**
+ * @brief The blocks read back from a binary file are the ones written, and a file damaged in its blocks or its header is rejected
+ */
+TEST(RhoFile, roundTrip) {
+    Basis basis(1.935801664793151, 2.829683956491218, 14, 1.3);
+    arma::mat rho;
+    rho.load("src/rho.arma", arma::arma_ascii);
+    RhoBlocks blocks(rho, basis);
+    const std::string path = "rho-test.bin";
+    RhoFile::write(path, blocks, 14, 1.3, 1.935801664793151, 2.829683956491218);
+
+    {
+        std::shared_ptr<const RhoFile> file = std::make_shared<const RhoFile>(path);
+        ASSERT_TRUE(file->matches(14, 1.3, 1.935801664793151, 2.829683956491218));
+        ASSERT_FALSE(file->matches(16, 1.3, 1.935801664793151, 2.829683956491218));
+        ASSERT_EQ(file->blocks(), blocks.size());
+        RhoBlocks mapped(file, basis);
+        ASSERT_EQ(mapped.is_symmetric(), blocks.is_symmetric());
+        ASSERT_EQ(mapped.conserves_parity(), blocks.conserves_parity());
+        for (int m = 0; m < blocks.size(); m++) {
+            // in place, and with the same bits
+            ASSERT_EQ(mapped.stored_memptr(m), file->block_data(m));
+            ASSERT_EQ(reinterpret_cast<uintptr_t>(file->block_data(m)) % RHO_FILE_ALIGNMENT, 0u);
+            ASSERT_EQ(arma::accu(mapped.block(m) != blocks.block(m)), 0u);
+        }
+    }
+
+    {
+        std::fstream damaged(path, std::ios::in | std::ios::out | std::ios::binary);
+        damaged.seekp(-1, std::ios::end);
+        damaged.put('\x7f');
+    }
+    ASSERT_THROW(RhoFile file(path), std::runtime_error);
+
+    // the checksum covers the header too: a flipped parity flag would fold z on any rho
+    RhoFile::write(path, blocks, 14, 1.3, 1.935801664793151, 2.829683956491218);
+    {
+        std::fstream damaged(path, std::ios::in | std::ios::out | std::ios::binary);
+        damaged.seekg(offsetof(RhoFileHeader, flags));
+        char flags = 0;
+        damaged.get(flags);
+        damaged.seekp(offsetof(RhoFileHeader, flags));
+        damaged.put(static_cast<char>(flags ^ RhoFile::flag_parity));
+    }
+    ASSERT_THROW(RhoFile file(path), std::runtime_error);
+    std::remove(path.c_str());
+}
@@ -0,0 +1,33 @@
+/**
+ * @file testsTreeReducer.cpp
+ *
+ * This file contains unit test for the class TreeReducer
+ */
+
+#include <gtest/gtest.h>
+#include <armadillo>
+
+#include "../src/TreeReducer.hpp"
+
+TEST(TreeReducer, Sum) {
+    arma::mat expected(arma::zeros(4, 3));
+    for (int i = 0; i < 100; i++) {
+        expected += (1.0 / (i + 1)) * arma::ones(4, 3);
+    }
+    // any number of slots, not only powers of two
+    for (int slots = 1; slots <= 9; slots++) {
+        TreeReducer<arma::mat> reducer(arma::zeros(4, 3), slots);
+        ASSERT_EQ(reducer.size(), slots);
+        for (int i = 0; i < 100; i++) {
+            reducer.local(i % slots) += (1.0 / (i + 1)) * arma::ones(4, 3);
+        }
+        ASSERT_LE(arma::abs(reducer.GetResult() - expected).max(), 1e-13);
+    }
+
+    TreeReducer<arma::mat> reducer(arma::zeros(4, 3));
+#pragma omp parallel for
+    for (int i = 0; i < 100; i++) {
+        reducer.push((1.0 / (i + 1)) * arma::ones(4, 3));
+    }
+    ASSERT_LE(arma::abs(reducer.GetResult() - expected).max(), 1e-13);
+}
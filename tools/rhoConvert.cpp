@@ -0,0 +1,46 @@
+/**
+ * @file rhoConvert.cpp
+ * Converts a density matrix saved with arma_ascii into the binary rho format of RhoFile.
+ *
+ * Usage : rhoConvert [input [output [N Q br bz]]]
+ * By default src/rho.arma is converted into src/rho.bin with the basis of NuclearDensityCalculator.
+ */
+
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <armadillo>
+
+#include "../src/Basis.h"
+#include "../src/RhoBlocks.h"
+#include "../src/RhoFile.h"
+
+int main(int argc, char** argv)
+{
+    const std::string input(argc>1 ? argv[1] : "src/rho.arma");
+    const std::string output(argc>2 ? argv[2] : "src/rho.bin");
+    const int N(argc>6 ? std::stoi(argv[3]) : 14);
+    const double Q(argc>6 ? std::stod(argv[4]) : 1.3);
+    const double br(argc>6 ? std::stod(argv[5]) : 1.935801664793151);
+    const double bz(argc>6 ? std::stod(argv[6]) : 2.829683956491218);
+
+    arma::mat rho;
+    if (!rho.load(input, arma::arma_ascii)) {
+        std::cerr << "cannot read " << input << std::endl;
+        return 1;
+    }
+    const Basis basis(br, bz, N, Q);
+    try {
+        const RhoBlocks blocks(rho, basis);
+        RhoFile::write(output, blocks, N, Q, br, bz);
+        /* read back, which checks the header and the checksum */
+        const RhoFile written(output);
+        std::cout << output << " : " << written.blocks() << " blocks"
+                  << (written.packed() ? ", packed" : "") << (written.conserves_parity() ? ", parity" : "") << std::endl;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}